@@ -54,6 +54,7 @@ int stop_vm(VMO_System *vmo, int id)
 /*
 This function retrieves the state of a virtual machine with the specified ID in a Virtual Machine Orchestration Management System (VMO System).
 It checks if the VMO system is empty, if the ID is valid and if the virtual machine is running, paused or stopped.
+VMs driven by the simulation mode (sim.h) may also be reported as starting or stopping.
 If the virtual machine is null, stopped or the ID is invalid, it returns the stopped state.
 */
 VM_State get_vm_state(VMO_System *vmo, int id)
@@ -1,3 +1,6 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,7 +10,9 @@ typedef enum
 {
     VM_STATE_RUNNING,
     VM_STATE_STOPPED,
-    VM_STATE_PAUSED
+    VM_STATE_PAUSED,
+    VM_STATE_STARTING, // Transitional state used by the simulation mode (sim.h)
+    VM_STATE_STOPPING  // Transitional state used by the simulation mode (sim.h)
 } VM_State;
 
 // Define a struct for virtual machines
@@ -25,6 +30,13 @@ typedef struct
     int num_vms;
 } VMO_System;
 
+/*
+The query indexes (query.h), the snapshot store (snapshot.h) and the simulation (sim.h) keep their own data
+about a VMO system and update it in their vmo_<layer>_* functions. A change made through one of them, or directly
+through the functions below, is not seen by the others until vmo_index_refresh or vmo_store_refresh is called.
+The simulation tracks timers by array position, so while it is attached it must be the only writer.
+*/
+
 // Function to initialize a VMO system with a specified number of virtual machines
 VMO_System init_vmo_system(int num_vms);
 
@@ -42,3 +54,5 @@ int stop_vm(VMO_System *vmo, int id);
 
 // Function to get the state of a virtual machine based on its ID
 VM_State get_vm_state(VMO_System *vmo, int id);
+
+#endif
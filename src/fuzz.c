@@ -0,0 +1,926 @@
+#include <stdint.h>
+#include <time.h>
+
+#include "bitmap.h"
+#include "query.h"
+#include "sim.h"
+#include "snapshot.h"
+
+/*
+Differential fuzz harness. Every input is decoded into a sequence of add_vm, remove_vm, start_vm, stop_vm and
+get_vm_state calls that is run against a small reference model of the solution/bitmap.c semantics and against
+every engine built on top of it: bitmap.h itself, the query indexes (query.h), the snapshot store (snapshot.h)
+and the simulation (sim.h). After every call the results and the full list of VMs of each engine are compared
+with the model, the sort orders and state bitmaps of the indexes are checked against the model, indexed queries
+are compared with a filter over the model, and snapshots are checked to still show the VMs they were taken with.
+The simulation gets mixed boot and shutdown times, and is compared with a model that also tracks the
+transitional states; inputs either run its transitions to completion or advance the clock part of the way.
+Any difference aborts with a report.
+
+With libFuzzer (clang), under AddressSanitizer and UndefinedBehaviorSanitizer:
+    clang -g -O1 -fsanitize=fuzzer,address,undefined -Isrc solution/bitmap.c src/sim.c src/query.c src/snapshot.c src/fuzz.c -lpthread -o vmo_fuzz
+    ./vmo_fuzz -max_len=4096 corpus/
+
+Without libFuzzer, VMO_FUZZ_MAIN adds a main that runs random inputs (property mode), replays input files,
+or writes a seed corpus of long inputs dominated by the hot calls, for throughput-oriented fuzzing:
+    gcc -g -O1 -DVMO_FUZZ_MAIN -fsanitize=address,undefined -Isrc solution/bitmap.c src/sim.c src/query.c src/snapshot.c src/fuzz.c -lpthread -o vmo_fuzz
+    ./vmo_fuzz [-runs N] [-seed S] [-corpus DIR] [input files...]
+*/
+
+#define FUZZ_MAX_VMS 512
+#define FUZZ_MAX_SNAPSHOTS 4
+#define FUZZ_PAGE_SIZE 8
+#define FUZZ_OP_SIZE 8
+
+// Define enumeration for the operations an input can contain
+typedef enum
+{
+    FUZZ_ADD_VM,
+    FUZZ_REMOVE_VM,
+    FUZZ_START_VM,
+    FUZZ_STOP_VM,
+    FUZZ_GET_VM_STATE,
+    FUZZ_QUERY,
+    FUZZ_SNAPSHOT,
+    FUZZ_ADVANCE,
+    FUZZ_NUM_OPS
+} Fuzz_Op;
+
+/*
+The reference model keeps the VMs in a fixed array and spells out the behaviour of solution/bitmap.c,
+including its quirks: new ids are num_vms + 1 (so they can repeat after a removal), the first VM with a
+matching id wins, and get_vm_state looks up the VM by position rather than by id.
+*/
+typedef struct
+{
+    int has_array; // Whether the vms array was allocated, which init_vmo_system(-1) does not do
+    int num_vms;
+    VM vms[FUZZ_MAX_VMS];
+} Fuzz_Model;
+
+// Define a struct for the simulation data of a VM in the simulation model
+typedef struct
+{
+    VMO_Tick boot_ticks;
+    VMO_Tick shutdown_ticks;
+    VMO_Tick expires; // 0 if no transition is pending
+} Fuzz_Sim_VM;
+
+// Define a struct for the simulation model, which adds boot and shutdown times to the reference model
+typedef struct
+{
+    Fuzz_Model model;
+    VMO_Tick now;
+    VMO_Tick default_boot_ticks;
+    VMO_Tick default_shutdown_ticks;
+    Fuzz_Sim_VM vms[FUZZ_MAX_VMS];
+} Fuzz_Sim_Model;
+
+typedef struct
+{
+    VMO_Snapshot *snapshot;
+    int num_vms;
+    VM vms[FUZZ_MAX_VMS];
+} Fuzz_Held_Snapshot;
+
+// Durations that land in every level of the timer wheel and in its overflow bucket
+static const VMO_Tick fuzz_durations[] = {0, 1, 2, 3, 255, 256, 257, 1000, 65535, 65536, 70000, 16777216,
+                                          4294967295ULL, 4294967296ULL, 10000000000ULL};
+#define FUZZ_NUM_DURATIONS ((int)(sizeof(fuzz_durations) / sizeof(fuzz_durations[0])))
+
+static void fuzz_fail(int step, const char *engine, const char *what, long long expected, long long actual)
+{
+    fprintf(stderr, "fuzz: step %d: %s: %s: expected %lld, got %lld\n", step, engine, what, expected, actual);
+    abort();
+}
+
+static void model_init(Fuzz_Model *model, int num_vms)
+{
+    model->has_array = num_vms >= 0;
+    model->num_vms = num_vms > 0 ? num_vms : 0;
+    for (int i = 0; i < model->num_vms; i++)
+    {
+        memset(&model->vms[i], 0, sizeof(VM));
+        model->vms[i].id = i;
+        snprintf(model->vms[i].name, sizeof(model->vms[i].name), "VM%d", i);
+        model->vms[i].state = VM_STATE_STOPPED;
+    }
+}
+
+static int model_find(const Fuzz_Model *model, int id)
+{
+    for (int i = 0; i < model->num_vms; i++)
+    {
+        if (model->vms[i].id == id)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int model_add_vm(Fuzz_Model *model, const char *name)
+{
+    if (name == NULL || strlen(name) > 49 || model->num_vms >= FUZZ_MAX_VMS)
+    {
+        return -1;
+    }
+    VM *vm = &model->vms[model->num_vms];
+    memset(vm, 0, sizeof(VM));
+    vm->id = model->num_vms + 1;
+    strcpy(vm->name, name);
+    vm->state = VM_STATE_STOPPED;
+    model->num_vms++;
+    model->has_array = 1;
+    return vm->id;
+}
+
+static int model_remove_vm(Fuzz_Model *model, int id)
+{
+    if (!model->has_array || model->num_vms <= 0)
+    {
+        return -1;
+    }
+    int i = model_find(model, id);
+    if (i < 0)
+    {
+        return -2;
+    }
+    memmove(&model->vms[i], &model->vms[i + 1], (model->num_vms - i - 1) * sizeof(VM));
+    model->num_vms--;
+    return 0;
+}
+
+// Makes a VM running and pauses every other running VM, as start_vm does for a VM that is not paused
+static void model_run_alone(Fuzz_Model *model, int i)
+{
+    for (int j = 0; j < model->num_vms; j++)
+    {
+        if (model->vms[j].state == VM_STATE_RUNNING)
+        {
+            model->vms[j].state = VM_STATE_PAUSED;
+        }
+    }
+    model->vms[i].state = VM_STATE_RUNNING;
+}
+
+static int model_start_vm(Fuzz_Model *model, int id)
+{
+    if (!model->has_array)
+    {
+        return -1;
+    }
+    int i = model_find(model, id);
+    if (i < 0)
+    {
+        return -2;
+    }
+    if (model->vms[i].state == VM_STATE_RUNNING)
+    {
+        return -3;
+    }
+    if (model->vms[i].state == VM_STATE_PAUSED)
+    {
+        model->vms[i].state = VM_STATE_RUNNING;
+    }
+    else
+    {
+        model_run_alone(model, i);
+    }
+    return 0;
+}
+
+static int model_stop_vm(Fuzz_Model *model, int id)
+{
+    if (!model->has_array || model->num_vms == 0)
+    {
+        return -2;
+    }
+    int i = model_find(model, id);
+    if (i < 0)
+    {
+        return -4;
+    }
+    if (model->vms[i].state != VM_STATE_RUNNING)
+    {
+        return -3;
+    }
+    model->vms[i].state = VM_STATE_STOPPED;
+    return 0;
+}
+
+static VM_State model_get_vm_state(const Fuzz_Model *model, int id)
+{
+    if (!model->has_array || model->num_vms == 0 || id < 0 || id >= model->num_vms)
+    {
+        return VM_STATE_STOPPED;
+    }
+    return model->vms[id].state;
+}
+
+/*
+The simulation model follows the simulation: a stopped VM that is started spends its boot time in
+VM_STATE_STARTING and then runs alone, a running VM that is stopped spends its shutdown time in
+VM_STATE_STOPPING, and a zero duration completes the transition straight away. Transitions complete in order
+of expiry; the harness never schedules two at the same tick, since the simulation leaves their order open.
+*/
+static void sim_model_init(Fuzz_Sim_Model *sim, int num_vms, VMO_Tick boot_ticks, VMO_Tick shutdown_ticks)
+{
+    model_init(&sim->model, num_vms);
+    sim->now = 0;
+    sim->default_boot_ticks = boot_ticks;
+    sim->default_shutdown_ticks = shutdown_ticks;
+    for (int i = 0; i < sim->model.num_vms; i++)
+    {
+        sim->vms[i].boot_ticks = boot_ticks;
+        sim->vms[i].shutdown_ticks = shutdown_ticks;
+        sim->vms[i].expires = 0;
+    }
+}
+
+static int sim_model_num_pending(const Fuzz_Sim_Model *sim)
+{
+    int pending = 0;
+    for (int i = 0; i < sim->model.num_vms; i++)
+    {
+        pending += sim->vms[i].expires != 0;
+    }
+    return pending;
+}
+
+// Returns the duration, made longer if needed so that the transition expires at a tick no other one uses
+static VMO_Tick sim_model_unique_duration(const Fuzz_Sim_Model *sim, VMO_Tick ticks)
+{
+    for (int i = 0; ticks > 0 && i < sim->model.num_vms; i++)
+    {
+        if (sim->vms[i].expires == sim->now + ticks)
+        {
+            ticks++;
+            i = -1;
+        }
+    }
+    return ticks;
+}
+
+static int sim_model_add_vm(Fuzz_Sim_Model *sim, const char *name)
+{
+    int id = model_add_vm(&sim->model, name);
+    if (id >= 0)
+    {
+        Fuzz_Sim_VM *vm = &sim->vms[sim->model.num_vms - 1];
+        vm->boot_ticks = sim->default_boot_ticks;
+        vm->shutdown_ticks = sim->default_shutdown_ticks;
+        vm->expires = 0;
+    }
+    return id;
+}
+
+static int sim_model_remove_vm(Fuzz_Sim_Model *sim, int id)
+{
+    int i = model_find(&sim->model, id);
+    int result = model_remove_vm(&sim->model, id);
+    if (result == 0)
+    {
+        memmove(&sim->vms[i], &sim->vms[i + 1], (sim->model.num_vms - i) * sizeof(Fuzz_Sim_VM));
+    }
+    return result;
+}
+
+static int sim_model_set_durations(Fuzz_Sim_Model *sim, int id, VMO_Tick boot_ticks, VMO_Tick shutdown_ticks)
+{
+    int i = model_find(&sim->model, id);
+    if (i < 0)
+    {
+        return -2;
+    }
+    sim->vms[i].boot_ticks = boot_ticks;
+    sim->vms[i].shutdown_ticks = shutdown_ticks;
+    return 0;
+}
+
+static int sim_model_start_vm(Fuzz_Sim_Model *sim, int id)
+{
+    if (!sim->model.has_array)
+    {
+        return -1;
+    }
+    int i = model_find(&sim->model, id);
+    if (i < 0)
+    {
+        return -2;
+    }
+    VM *vm = &sim->model.vms[i];
+    if (vm->state == VM_STATE_RUNNING || vm->state == VM_STATE_STARTING)
+    {
+        return -3;
+    }
+    if (vm->state == VM_STATE_STOPPING)
+    {
+        return -4;
+    }
+    if (vm->state == VM_STATE_PAUSED)
+    {
+        vm->state = VM_STATE_RUNNING;
+    }
+    else if (sim->vms[i].boot_ticks == 0)
+    {
+        model_run_alone(&sim->model, i);
+    }
+    else
+    {
+        vm->state = VM_STATE_STARTING;
+        sim->vms[i].expires = sim->now + sim->vms[i].boot_ticks;
+    }
+    return 0;
+}
+
+static int sim_model_stop_vm(Fuzz_Sim_Model *sim, int id)
+{
+    if (!sim->model.has_array || sim->model.num_vms == 0)
+    {
+        return -2;
+    }
+    int i = model_find(&sim->model, id);
+    if (i < 0)
+    {
+        return -4;
+    }
+    VM *vm = &sim->model.vms[i];
+    if (vm->state != VM_STATE_RUNNING)
+    {
+        return -3;
+    }
+    if (sim->vms[i].shutdown_ticks == 0)
+    {
+        vm->state = VM_STATE_STOPPED;
+    }
+    else
+    {
+        vm->state = VM_STATE_STOPPING;
+        sim->vms[i].expires = sim->now + sim->vms[i].shutdown_ticks;
+    }
+    return 0;
+}
+
+// Completes every transition due by target in order of expiry; with until_idle the clock stays at the last one
+static int sim_model_advance(Fuzz_Sim_Model *sim, VMO_Tick target, int until_idle)
+{
+    int completed = 0;
+    for (;;)
+    {
+        int next = -1;
+        for (int i = 0; i < sim->model.num_vms; i++)
+        {
+            if (sim->vms[i].expires != 0 && sim->vms[i].expires <= target &&
+                (next < 0 || sim->vms[i].expires < sim->vms[next].expires))
+            {
+                next = i;
+            }
+        }
+        if (next < 0)
+        {
+            break;
+        }
+        sim->now = sim->vms[next].expires;
+        sim->vms[next].expires = 0;
+        if (sim->model.vms[next].state == VM_STATE_STARTING)
+        {
+            model_run_alone(&sim->model, next);
+        }
+        else
+        {
+            sim->model.vms[next].state = VM_STATE_STOPPED;
+        }
+        completed++;
+    }
+    if (!until_idle)
+    {
+        sim->now = target;
+    }
+    return completed;
+}
+
+/*
+Turns a 16 bit selector into an id (or a position, for get_vm_state) scaled to the current number of VMs.
+With the top bit set it picks the id of an existing VM, which covers ids far above num_vms and repeated ids.
+Otherwise it picks a value from -1 to num_vms + 1, so lookups just outside the range are covered too.
+*/
+static int fuzz_select(const Fuzz_Model *model, unsigned int selector)
+{
+    if ((selector & 0x8000) && model->num_vms > 0)
+    {
+        return model->vms[(selector & 0x7fff) % model->num_vms].id;
+    }
+    return (int)((selector & 0x7fff) % (unsigned int)(model->num_vms + 3)) - 1;
+}
+
+static void fuzz_compare_vms(int step, const char *engine, const VM *expected, int expected_num, const VM *actual, int actual_num)
+{
+    if (expected_num != actual_num)
+    {
+        fuzz_fail(step, engine, "num_vms", expected_num, actual_num);
+    }
+    for (int i = 0; i < expected_num; i++)
+    {
+        if (expected[i].id != actual[i].id)
+        {
+            fuzz_fail(step, engine, "id", expected[i].id, actual[i].id);
+        }
+        if (expected[i].state != actual[i].state)
+        {
+            fuzz_fail(step, engine, "state", expected[i].state, actual[i].state);
+        }
+        if (strncmp(expected[i].name, actual[i].name, sizeof(expected[i].name)) != 0)
+        {
+            fuzz_fail(step, engine, "name", i, -1);
+        }
+    }
+}
+
+static void fuzz_compare_snapshot(int step, const Fuzz_Held_Snapshot *held)
+{
+    if (held->snapshot->num_vms != held->num_vms)
+    {
+        fuzz_fail(step, "snapshot", "num_vms", held->num_vms, held->snapshot->num_vms);
+    }
+    for (int i = 0; i < held->num_vms; i++)
+    {
+        fuzz_compare_vms(step, "snapshot", &held->vms[i], 1, vmo_snapshot_get(held->snapshot, i), 1);
+    }
+}
+
+static int fuzz_sort_by_name;
+
+// Orders positions of the model like the query indexes do: by name (if requested), then id, then position
+static int fuzz_compare_positions(const Fuzz_Model *model, int a, int b)
+{
+    const VM *x = &model->vms[a];
+    const VM *y = &model->vms[b];
+    if (fuzz_sort_by_name)
+    {
+        int c = strncmp(x->name, y->name, sizeof(x->name));
+        if (c != 0)
+        {
+            return c;
+        }
+    }
+    if (x->id != y->id)
+    {
+        return x->id < y->id ? -1 : 1;
+    }
+    return a < b ? -1 : (a > b);
+}
+
+// Checks that a sort order of the indexes holds every position once, in the order the model gives them
+static void fuzz_check_order(int step, const char *what, const int *order, const Fuzz_Model *model, int by_name)
+{
+    static char seen[FUZZ_MAX_VMS];
+    memset(seen, 0, sizeof(seen));
+    fuzz_sort_by_name = by_name;
+    for (int i = 0; i < model->num_vms; i++)
+    {
+        int pos = order[i];
+        if (pos < 0 || pos >= model->num_vms || seen[pos])
+        {
+            fuzz_fail(step, "query", what, i, pos);
+        }
+        seen[pos] = 1;
+        if (i > 0 && fuzz_compare_positions(model, order[i - 1], pos) >= 0)
+        {
+            fuzz_fail(step, "query", what, order[i - 1], pos);
+        }
+    }
+}
+
+// Checks the sort orders, the state bitmaps and the state counts of the indexes against the model
+static void fuzz_check_index(int step, const VMO_Index *index, const Fuzz_Model *model)
+{
+    int word_bits = (int)(8 * sizeof(unsigned long long));
+    if (index->capacity < model->num_vms)
+    {
+        fuzz_fail(step, "query", "capacity", model->num_vms, index->capacity);
+    }
+    fuzz_check_order(step, "by_id", index->by_id, model, 0);
+    fuzz_check_order(step, "by_name", index->by_name, model, 1);
+    for (int s = 0; s < VMO_NUM_STATES; s++)
+    {
+        int count = 0;
+        for (int pos = 0; pos < index->capacity; pos++)
+        {
+            int expected = pos < model->num_vms && (int)model->vms[pos].state == s;
+            int bit = (int)((index->state_bits[s][pos / word_bits] >> (pos % word_bits)) & 1);
+            if (bit != expected)
+            {
+                fuzz_fail(step, "query", "state bit", expected, bit);
+            }
+            count += expected;
+        }
+        if (index->state_count[s] != count)
+        {
+            fuzz_fail(step, "query", "state count", count, index->state_count[s]);
+        }
+    }
+}
+
+// Pages through a query over the indexes and compares every page with a filter and sort over the model
+static void fuzz_check_query(int step, VMO_Index *index, const Fuzz_Model *model, const uint8_t *args)
+{
+    static const char *prefixes[] = {NULL, "", "V", "VM1", "db-", "db-1", "x"};
+    VMO_Query query;
+    vmo_query_init(&query, 1 + args[0] % FUZZ_PAGE_SIZE);
+    query.state_mask = args[1] & 0x1f;
+    query.name_prefix = prefixes[args[2] % (sizeof(prefixes) / sizeof(prefixes[0]))];
+    if (args[3] & 1)
+    {
+        query.min_id = (int8_t)args[4] * 2;
+        query.max_id = query.min_id + (args[3] >> 1) * 2;
+    }
+    query.sort_by = args[2] & 0x80 ? VMO_SORT_BY_NAME : VMO_SORT_BY_ID;
+    query.descending = (args[1] & 0x80) != 0;
+
+    int expected[FUZZ_MAX_VMS];
+    int num_expected = 0;
+    size_t prefix_len = query.name_prefix != NULL ? strlen(query.name_prefix) : 0;
+    for (int i = 0; i < model->num_vms; i++)
+    {
+        const VM *vm = &model->vms[i];
+        if ((query.state_mask == 0 || (query.state_mask & VMO_STATE_BIT(vm->state))) &&
+            vm->id >= query.min_id && vm->id <= query.max_id &&
+            strncmp(vm->name, query.name_prefix != NULL ? query.name_prefix : "", prefix_len) == 0)
+        {
+            expected[num_expected++] = i;
+        }
+    }
+    // Insertion sort, kept simple on purpose so the check does not share code with the indexes
+    fuzz_sort_by_name = query.sort_by == VMO_SORT_BY_NAME;
+    for (int i = 1; i < num_expected; i++)
+    {
+        int pos = expected[i];
+        int j = i;
+        while (j > 0 && fuzz_compare_positions(model, expected[j - 1], pos) > 0)
+        {
+            expected[j] = expected[j - 1];
+            j--;
+        }
+        expected[j] = pos;
+    }
+
+    int seen = 0;
+    VM page[FUZZ_PAGE_SIZE];
+    VMO_Cursor next;
+    for (;;)
+    {
+        int count = vmo_query(index, &query, page, &next);
+        if (count < 0 || seen + count > num_expected)
+        {
+            fuzz_fail(step, "query", "page size", num_expected - seen, count);
+        }
+        for (int i = 0; i < count; i++, seen++)
+        {
+            int pos = expected[query.descending ? num_expected - 1 - seen : seen];
+            fuzz_compare_vms(step, "query", &model->vms[pos], 1, &page[i], 1);
+        }
+        if (!next.valid)
+        {
+            break;
+        }
+        query.after = next;
+    }
+    if (seen != num_expected)
+    {
+        fuzz_fail(step, "query", "matches", num_expected, seen);
+    }
+}
+
+static void fuzz_check_result(int step, const char *engine, long long expected, long long actual)
+{
+    if (expected != actual)
+    {
+        fuzz_fail(step, engine, "result", expected, actual);
+    }
+}
+
+// Gives a VM of the simulation a boot and shutdown time picked by the input, at a tick no other transition uses
+static void fuzz_sim_prepare(int step, VMO_Sim *sim, Fuzz_Sim_Model *model, int id, const uint8_t *args)
+{
+    VMO_Tick ticks = sim_model_unique_duration(model, fuzz_durations[args[0] % FUZZ_NUM_DURATIONS] + args[2] % 4);
+    fuzz_check_result(step, "sim", sim_model_set_durations(model, id, ticks, ticks),
+                      vmo_sim_set_durations(sim, id, ticks, ticks));
+}
+
+static void fuzz_sim_run(int step, VMO_Sim *sim, Fuzz_Sim_Model *model)
+{
+    fuzz_check_result(step, "sim", sim_model_advance(model, (VMO_Tick)-1, 1), vmo_sim_run(sim));
+}
+
+/*
+Runs one input. The first byte picks the size of the initial system (0xff means init_vmo_system(-1)), and
+every following group of 8 bytes is one operation: the operation, a 16 bit selector for the id or position
+(see fuzz_select), and five bytes of arguments for names, durations, queries and snapshots.
+*/
+static void fuzz_run(const uint8_t *data, size_t size)
+{
+    if (size < 1)
+    {
+        return;
+    }
+    int initial = data[0] == 0xff ? -1 : data[0] % 64;
+
+    static Fuzz_Model model;
+    static Fuzz_Sim_Model sim_model;
+    static Fuzz_Held_Snapshot held[FUZZ_MAX_SNAPSHOTS];
+    model_init(&model, initial);
+    sim_model_init(&sim_model, initial, 5, 3);
+    VMO_System plain = init_vmo_system(initial);
+    VMO_System indexed = init_vmo_system(initial);
+    VMO_System stored = init_vmo_system(initial);
+    VMO_System simulated = init_vmo_system(initial);
+    VMO_Index index;
+    VMO_Store store;
+    VMO_Sim sim;
+    if (vmo_index_build(&index, &indexed) != 0 || vmo_store_init(&store, &stored) != 0 ||
+        vmo_sim_init(&sim, &simulated, 5, 3) != 0)
+    {
+        fuzz_fail(0, "setup", "init", 0, -1);
+    }
+    int num_held = 0;
+
+    int step = 0;
+    for (size_t pos = 1; pos + FUZZ_OP_SIZE <= size; pos += FUZZ_OP_SIZE, step++)
+    {
+        Fuzz_Op op = (Fuzz_Op)(data[pos] % FUZZ_NUM_OPS);
+        int id = fuzz_select(&model, data[pos + 1] | (data[pos + 2] << 8));
+        const uint8_t *args = &data[pos + 3];
+        int expected = 0;
+        switch (op)
+        {
+        case FUZZ_ADD_VM:
+        {
+            char name[64];
+            if (args[0] % 16 == 0)
+            {
+                // Too long for add_vm
+                memset(name, 'n', 50);
+                name[50] = '\0';
+            }
+            else
+            {
+                snprintf(name, sizeof(name), args[0] & 1 ? "db-%d" : "VM%d", id);
+            }
+            if (model.num_vms >= FUZZ_MAX_VMS)
+            {
+                continue;
+            }
+            expected = model_add_vm(&model, name);
+            fuzz_check_result(step, "bitmap", expected, add_vm(&plain, name));
+            fuzz_check_result(step, "query", expected, vmo_index_add_vm(&index, name));
+            fuzz_check_result(step, "snapshot", expected, vmo_store_add_vm(&store, name));
+            fuzz_check_result(step, "sim", sim_model_add_vm(&sim_model, name), vmo_sim_add_vm(&sim, name));
+            break;
+        }
+        case FUZZ_REMOVE_VM:
+            expected = model_remove_vm(&model, id);
+            fuzz_check_result(step, "bitmap", expected, remove_vm(&plain, id));
+            fuzz_check_result(step, "query", expected, vmo_index_remove_vm(&index, id));
+            fuzz_check_result(step, "snapshot", expected, vmo_store_remove_vm(&store, id));
+            fuzz_check_result(step, "sim", sim_model_remove_vm(&sim_model, id), vmo_sim_remove_vm(&sim, id));
+            break;
+        case FUZZ_START_VM:
+            expected = model_start_vm(&model, id);
+            fuzz_check_result(step, "bitmap", expected, start_vm(&plain, id));
+            fuzz_check_result(step, "query", expected, vmo_index_start_vm(&index, id));
+            fuzz_check_result(step, "snapshot", expected, vmo_store_start_vm(&store, id));
+            fuzz_sim_prepare(step, &sim, &sim_model, id, args);
+            fuzz_check_result(step, "sim", sim_model_start_vm(&sim_model, id), vmo_sim_start_vm(&sim, id));
+            if (args[1] & 3)
+            {
+                fuzz_sim_run(step, &sim, &sim_model);
+            }
+            break;
+        case FUZZ_STOP_VM:
+            expected = model_stop_vm(&model, id);
+            fuzz_check_result(step, "bitmap", expected, stop_vm(&plain, id));
+            fuzz_check_result(step, "query", expected, vmo_index_stop_vm(&index, id));
+            fuzz_check_result(step, "snapshot", expected, vmo_store_stop_vm(&store, id));
+            fuzz_sim_prepare(step, &sim, &sim_model, id, args);
+            fuzz_check_result(step, "sim", sim_model_stop_vm(&sim_model, id), vmo_sim_stop_vm(&sim, id));
+            if (args[1] & 3)
+            {
+                fuzz_sim_run(step, &sim, &sim_model);
+            }
+            break;
+        case FUZZ_GET_VM_STATE:
+            expected = model_get_vm_state(&model, id);
+            fuzz_check_result(step, "bitmap", expected, get_vm_state(&plain, id));
+            fuzz_check_result(step, "query", expected, get_vm_state(&indexed, id));
+            fuzz_check_result(step, "snapshot", expected, get_vm_state(&stored, id));
+            fuzz_check_result(step, "sim", model_get_vm_state(&sim_model.model, id), get_vm_state(&simulated, id));
+            break;
+        case FUZZ_QUERY:
+            fuzz_check_query(step, &index, &model, args);
+            break;
+        case FUZZ_SNAPSHOT:
+            if (num_held == FUZZ_MAX_SNAPSHOTS || (num_held > 0 && (args[0] & 1)))
+            {
+                // Release a held snapshot after checking it did not change
+                int i = args[1] % num_held;
+                fuzz_compare_snapshot(step, &held[i]);
+                vmo_snapshot_release(held[i].snapshot);
+                held[i] = held[--num_held];
+            }
+            else
+            {
+                held[num_held].snapshot = vmo_snapshot_acquire(&store);
+                held[num_held].num_vms = model.num_vms;
+                memcpy(held[num_held].vms, model.vms, model.num_vms * sizeof(VM));
+                fuzz_compare_snapshot(step, &held[num_held]);
+                num_held++;
+            }
+            break;
+        case FUZZ_ADVANCE:
+            if (args[1] % 4 == 0)
+            {
+                fuzz_sim_run(step, &sim, &sim_model);
+            }
+            else
+            {
+                // Advance part of the way, so transitions are left pending and cascade through the wheel later
+                VMO_Tick ticks = fuzz_durations[args[0] % FUZZ_NUM_DURATIONS] + args[2];
+                fuzz_check_result(step, "sim", sim_model_advance(&sim_model, sim_model.now + ticks, 0),
+                                  vmo_sim_advance(&sim, ticks));
+            }
+            break;
+        default:
+            break;
+        }
+
+        fuzz_compare_vms(step, "bitmap", model.vms, model.num_vms, plain.vms, plain.num_vms);
+        fuzz_compare_vms(step, "query", model.vms, model.num_vms, indexed.vms, indexed.num_vms);
+        fuzz_compare_vms(step, "snapshot", model.vms, model.num_vms, stored.vms, stored.num_vms);
+        fuzz_compare_vms(step, "sim", sim_model.model.vms, sim_model.model.num_vms, simulated.vms, simulated.num_vms);
+        fuzz_check_index(step, &index, &model);
+        // An unfiltered query and a query for one state on every step, besides the random queries
+        uint8_t all[5] = {(uint8_t)step, 0, 0, 0, 0};
+        uint8_t one_state[5] = {(uint8_t)step, (uint8_t)VMO_STATE_BIT(step % VMO_NUM_STATES), 0, 0, 0};
+        fuzz_check_query(step, &index, &model, all);
+        fuzz_check_query(step, &index, &model, one_state);
+        if (sim.num_pending != sim_model_num_pending(&sim_model))
+        {
+            fuzz_fail(step, "sim", "pending transitions", sim_model_num_pending(&sim_model), sim.num_pending);
+        }
+        if (sim.now != sim_model.now)
+        {
+            fuzz_fail(step, "sim", "now", (long long)sim_model.now, (long long)sim.now);
+        }
+    }
+
+    for (int i = 0; i < num_held; i++)
+    {
+        fuzz_compare_snapshot(step, &held[i]);
+        vmo_snapshot_release(held[i].snapshot);
+    }
+    vmo_index_free(&index);
+    vmo_store_free(&store);
+    vmo_sim_free(&sim);
+    free(plain.vms);
+    free(indexed.vms);
+    free(stored.vms);
+    free(simulated.vms);
+}
+
+#ifdef __cplusplus
+extern "C"
+#endif
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    fuzz_run(data, size);
+    return 0;
+}
+
+#ifdef VMO_FUZZ_MAIN
+
+#define FUZZ_MAX_INPUT 4096
+
+static uint64_t fuzz_rng;
+
+static uint8_t fuzz_random_byte(void)
+{
+    // xorshift64*
+    fuzz_rng ^= fuzz_rng >> 12;
+    fuzz_rng ^= fuzz_rng << 25;
+    fuzz_rng ^= fuzz_rng >> 27;
+    return (uint8_t)((fuzz_rng * 2685821657736338717ULL) >> 56);
+}
+
+/*
+Fills an input of random operations. Throughput-oriented inputs are long and weighted towards the calls a
+control plane makes most (get_vm_state, start_vm and stop_vm on existing VMs of a fleet that keeps growing),
+so that the engines are exercised at the sizes where their indexes and shared chunks matter.
+*/
+static size_t fuzz_random_input(uint8_t *data, int throughput)
+{
+    size_t size = throughput ? FUZZ_MAX_INPUT - (FUZZ_MAX_INPUT - 1) % FUZZ_OP_SIZE
+                             : 1 + FUZZ_OP_SIZE * (fuzz_random_byte() % 64);
+    for (size_t i = 0; i < size; i++)
+    {
+        data[i] = fuzz_random_byte();
+    }
+    if (throughput)
+    {
+        static const uint8_t weighted[] = {FUZZ_ADD_VM, FUZZ_ADD_VM, FUZZ_GET_VM_STATE, FUZZ_GET_VM_STATE,
+                                           FUZZ_START_VM, FUZZ_START_VM, FUZZ_STOP_VM, FUZZ_REMOVE_VM,
+                                           FUZZ_QUERY, FUZZ_SNAPSHOT, FUZZ_ADVANCE};
+        data[0] = fuzz_random_byte() % 64;
+        for (size_t pos = 1; pos + FUZZ_OP_SIZE <= size; pos += FUZZ_OP_SIZE)
+        {
+            data[pos] = weighted[data[pos] % sizeof(weighted)];
+            // Mostly target VMs that exist
+            if (data[pos + 1] % 4 != 0)
+            {
+                data[pos + 2] |= 0x80;
+            }
+        }
+    }
+    return size;
+}
+
+int main(int argc, char **argv)
+{
+    long runs = 10000;
+    const char *corpus = NULL;
+    fuzz_rng = 0x9e3779b97f4a7c15ULL;
+    int first_file = argc;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-runs") == 0 && i + 1 < argc)
+        {
+            runs = atol(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc)
+        {
+            fuzz_rng = strtoull(argv[++i], NULL, 0) | 1;
+        }
+        else if (strcmp(argv[i], "-corpus") == 0 && i + 1 < argc)
+        {
+            corpus = argv[++i];
+        }
+        else
+        {
+            first_file = i;
+            break;
+        }
+    }
+
+    static uint8_t data[FUZZ_MAX_INPUT];
+    if (corpus != NULL)
+    {
+        // Write a seed corpus of throughput-oriented inputs for libFuzzer
+        for (long r = 0; r < runs; r++)
+        {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/seed-%04ld", corpus, r);
+            FILE *file = fopen(path, "wb");
+            if (file == NULL)
+            {
+                fprintf(stderr, "fuzz: cannot write %s\n", path);
+                return 1;
+            }
+            fwrite(data, 1, fuzz_random_input(data, 1), file);
+            fclose(file);
+        }
+        return 0;
+    }
+
+    if (first_file < argc)
+    {
+        // Replay the given inputs, e.g. a crash found by libFuzzer
+        for (int i = first_file; i < argc; i++)
+        {
+            FILE *file = fopen(argv[i], "rb");
+            if (file == NULL)
+            {
+                fprintf(stderr, "fuzz: cannot read %s\n", argv[i]);
+                return 1;
+            }
+            size_t size = fread(data, 1, sizeof(data), file);
+            fclose(file);
+            fuzz_run(data, size);
+        }
+        printf("fuzz: replayed %d inputs\n", argc - first_file);
+        return 0;
+    }
+
+    long ops = 0;
+    clock_t start = clock();
+    for (long r = 0; r < runs; r++)
+    {
+        size_t size = fuzz_random_input(data, r % 2);
+        fuzz_run(data, size);
+        ops += (long)(size - 1) / FUZZ_OP_SIZE;
+    }
+    double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+    printf("fuzz: %ld inputs, %ld operations, %.0f operations/s\n", runs, ops, seconds > 0 ? ops / seconds : 0.0);
+    return 0;
+}
+
+#endif
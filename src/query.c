@@ -0,0 +1,666 @@
+#include "query.h"
+
+#include <limits.h>
+
+#define VMO_INDEX_MIN_CAPACITY 64
+#define VMO_INDEX_WORD_BITS 64
+
+static int index_compare_id(const void *a, const void *b)
+{
+    const VM *x = *(const VM *const *)a;
+    const VM *y = *(const VM *const *)b;
+    if (x->id != y->id)
+    {
+        return x->id < y->id ? -1 : 1;
+    }
+    // VMs with the same id keep their order in the vms array, like the linear scans in bitmap.c
+    return x < y ? -1 : (x > y);
+}
+
+static int index_compare_name(const void *a, const void *b)
+{
+    const VM *x = *(const VM *const *)a;
+    const VM *y = *(const VM *const *)b;
+    int c = strncmp(x->name, y->name, sizeof(x->name));
+    if (c != 0)
+    {
+        return c;
+    }
+    return index_compare_id(a, b);
+}
+
+// Compares the VM at a position with a (name, id, position) key in the order of the given sort
+static int index_compare_key(VMO_Index *index, VMO_Sort_Key sort_by, int pos, int id, const char *name, int key_pos)
+{
+    const VM *vm = &index->vmo->vms[pos];
+    if (sort_by == VMO_SORT_BY_NAME)
+    {
+        int c = strncmp(vm->name, name, sizeof(vm->name));
+        if (c != 0)
+        {
+            return c;
+        }
+    }
+    if (vm->id != id)
+    {
+        return vm->id < id ? -1 : 1;
+    }
+    return pos < key_pos ? -1 : (pos > key_pos);
+}
+
+// Returns the first of the num entries of the sort order that is greater than the key (or equal to it, if inclusive)
+static int index_search(VMO_Index *index, VMO_Sort_Key sort_by, int num, int id, const char *name, int key_pos, int inclusive)
+{
+    const int *order = sort_by == VMO_SORT_BY_NAME ? index->by_name : index->by_id;
+    int lo = 0;
+    int hi = num;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        int c = index_compare_key(index, sort_by, order[mid], id, name, key_pos);
+        if (c < 0 || (c == 0 && !inclusive))
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Returns the first entry of the name order whose name starts with the prefix (or comes after it, if not inclusive)
+static int index_search_prefix(VMO_Index *index, const char *prefix, size_t len, int inclusive)
+{
+    int lo = 0;
+    int hi = index->vmo->num_vms;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        int c = strncmp(index->vmo->vms[index->by_name[mid]].name, prefix, len);
+        if (c < 0 || (c == 0 && !inclusive))
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Returns the position of the first VM with the given id, or -1 if there is none
+static int index_find(VMO_Index *index, int id)
+{
+    int i = index_search(index, VMO_SORT_BY_ID, index->vmo->num_vms, id, NULL, INT_MIN, 1);
+    if (i < index->vmo->num_vms && index->vmo->vms[index->by_id[i]].id == id)
+    {
+        return index->by_id[i];
+    }
+    return -1;
+}
+
+static int index_get_bit(const unsigned long long *bits, int pos)
+{
+    return (bits[pos / VMO_INDEX_WORD_BITS] >> (pos % VMO_INDEX_WORD_BITS)) & 1;
+}
+
+static void index_set_bit(unsigned long long *bits, int pos, int value)
+{
+    unsigned long long mask = 1ULL << (pos % VMO_INDEX_WORD_BITS);
+    if (value)
+    {
+        bits[pos / VMO_INDEX_WORD_BITS] |= mask;
+    }
+    else
+    {
+        bits[pos / VMO_INDEX_WORD_BITS] &= ~mask;
+    }
+}
+
+// Makes the state bitmaps agree with the state of the VM at a position
+static void index_sync_state(VMO_Index *index, int pos)
+{
+    for (int s = 0; s < VMO_NUM_STATES; s++)
+    {
+        if (index_get_bit(index->state_bits[s], pos))
+        {
+            index_set_bit(index->state_bits[s], pos, 0);
+            index->state_count[s]--;
+        }
+    }
+    VM_State state = index->vmo->vms[pos].state;
+    if ((int)state >= 0 && (int)state < VMO_NUM_STATES)
+    {
+        index_set_bit(index->state_bits[state], pos, 1);
+        index->state_count[state]++;
+    }
+}
+
+static int index_reserve(VMO_Index *index, int num_vms)
+{
+    if (num_vms <= index->capacity)
+    {
+        return 0;
+    }
+    int capacity = index->capacity > 0 ? index->capacity : VMO_INDEX_MIN_CAPACITY;
+    while (capacity < num_vms)
+    {
+        capacity *= 2;
+    }
+    int *by_id = (int *)realloc(index->by_id, capacity * sizeof(int));
+    if (by_id == NULL)
+    {
+        return -1;
+    }
+    index->by_id = by_id;
+    int *by_name = (int *)realloc(index->by_name, capacity * sizeof(int));
+    if (by_name == NULL)
+    {
+        return -1;
+    }
+    index->by_name = by_name;
+
+    int old_words = index->capacity / VMO_INDEX_WORD_BITS;
+    int words = capacity / VMO_INDEX_WORD_BITS;
+    for (int s = 0; s < VMO_NUM_STATES; s++)
+    {
+        unsigned long long *bits = (unsigned long long *)realloc(index->state_bits[s], words * sizeof(unsigned long long));
+        if (bits == NULL)
+        {
+            return -1;
+        }
+        memset(bits + old_words, 0, (words - old_words) * sizeof(unsigned long long));
+        index->state_bits[s] = bits;
+    }
+    index->capacity = capacity;
+    return 0;
+}
+
+// Removes the entry for a position from a sort order and renumbers the positions that follow it
+static void index_remove_position(int *order, int num_vms, int entry, int pos)
+{
+    memmove(&order[entry], &order[entry + 1], (num_vms - entry) * sizeof(int));
+    for (int i = 0; i < num_vms; i++)
+    {
+        if (order[i] > pos)
+        {
+            order[i]--;
+        }
+    }
+}
+
+// Sorts every position of the VMO system into both orders and sets the state bitmaps from scratch
+static int index_fill(VMO_Index *index)
+{
+    VMO_System *vmo = index->vmo;
+    const VM **sorted = (const VM **)malloc((vmo->num_vms > 0 ? vmo->num_vms : 1) * sizeof(VM *));
+    if (sorted == NULL || index_reserve(index, vmo->num_vms) != 0)
+    {
+        free(sorted);
+        return -1;
+    }
+    int words = index->capacity / VMO_INDEX_WORD_BITS;
+    for (int s = 0; s < VMO_NUM_STATES; s++)
+    {
+        if (words > 0)
+        {
+            memset(index->state_bits[s], 0, words * sizeof(unsigned long long));
+        }
+        index->state_count[s] = 0;
+    }
+    for (int i = 0; i < vmo->num_vms; i++)
+    {
+        sorted[i] = &vmo->vms[i];
+        index_sync_state(index, i);
+    }
+    qsort(sorted, vmo->num_vms, sizeof(VM *), index_compare_id);
+    for (int i = 0; i < vmo->num_vms; i++)
+    {
+        index->by_id[i] = (int)(sorted[i] - vmo->vms);
+    }
+    qsort(sorted, vmo->num_vms, sizeof(VM *), index_compare_name);
+    for (int i = 0; i < vmo->num_vms; i++)
+    {
+        index->by_name[i] = (int)(sorted[i] - vmo->vms);
+    }
+    free(sorted);
+    return 0;
+}
+
+/*
+The vmo_index_build function creates the secondary indexes of a VMO system: the positions of all VMs sorted
+by id and by name, and one bitmap per state. The indexes only hold positions, so building them does not copy
+any VM. The function returns 0 on success, -1 if the input is invalid and -2 if memory allocation fails.
+*/
+int vmo_index_build(VMO_Index *index, VMO_System *vmo)
+{
+    if (index == NULL || vmo == NULL || vmo->num_vms < 0 || (vmo->vms == NULL && vmo->num_vms > 0))
+    {
+        return -1;
+    }
+    memset(index, 0, sizeof(VMO_Index));
+    index->vmo = vmo;
+    if (index_fill(index) != 0)
+    {
+        vmo_index_free(index);
+        return -2;
+    }
+    return 0;
+}
+
+/*
+The vmo_index_refresh function brings the indexes up to date after the VMO system was changed without going
+through the vmo_index_* functions, e.g. directly through bitmap.h or through another layer. It sorts the VMs
+again, reusing the memory of the indexes. It returns 0 on success, -1 if the indexes are invalid and -2 if
+memory allocation fails, in which case the indexes are released and must be built again.
+*/
+int vmo_index_refresh(VMO_Index *index)
+{
+    if (index == NULL || index->vmo == NULL || index->vmo->num_vms < 0 ||
+        (index->vmo->vms == NULL && index->vmo->num_vms > 0))
+    {
+        return -1;
+    }
+    if (index_fill(index) != 0)
+    {
+        vmo_index_free(index);
+        return -2;
+    }
+    return 0;
+}
+
+/*
+The vmo_index_free function releases the sort orders and state bitmaps of the indexes.
+*/
+void vmo_index_free(VMO_Index *index)
+{
+    if (index == NULL)
+    {
+        return;
+    }
+    free(index->by_id);
+    free(index->by_name);
+    for (int s = 0; s < VMO_NUM_STATES; s++)
+    {
+        free(index->state_bits[s]);
+    }
+    memset(index, 0, sizeof(VMO_Index));
+}
+
+/*
+The vmo_index_add_vm function adds a VM with add_vm and inserts it into both sort orders with a binary search.
+It returns the ID of the new VM, or -1 if there was an error.
+*/
+int vmo_index_add_vm(VMO_Index *index, char *name)
+{
+    if (index == NULL || index->vmo == NULL || index_reserve(index, index->vmo->num_vms + 1) != 0)
+    {
+        return -1;
+    }
+    int id = add_vm(index->vmo, name);
+    if (id < 0)
+    {
+        return id;
+    }
+
+    int pos = index->vmo->num_vms - 1;
+    VM *vm = &index->vmo->vms[pos];
+    // The new VM is not in the sort orders yet, so search among the pos entries before it
+    int by_id = index_search(index, VMO_SORT_BY_ID, pos, vm->id, vm->name, pos, 0);
+    int by_name = index_search(index, VMO_SORT_BY_NAME, pos, vm->id, vm->name, pos, 0);
+
+    memmove(&index->by_id[by_id + 1], &index->by_id[by_id], (pos - by_id) * sizeof(int));
+    index->by_id[by_id] = pos;
+    memmove(&index->by_name[by_name + 1], &index->by_name[by_name], (pos - by_name) * sizeof(int));
+    index->by_name[by_name] = pos;
+    index_sync_state(index, pos);
+    return id;
+}
+
+/*
+The vmo_index_remove_vm function removes a VM with remove_vm. Because remove_vm shifts the vms array, every
+position after the removed VM is renumbered in both sort orders and the state bitmaps are shifted down by one.
+It returns the result of remove_vm, or -1 if the indexes are invalid.
+*/
+int vmo_index_remove_vm(VMO_Index *index, int id)
+{
+    if (index == NULL || index->vmo == NULL)
+    {
+        return -1;
+    }
+    int pos = index->vmo->vms != NULL ? index_find(index, id) : -1;
+    int by_id = 0;
+    int by_name = 0;
+    if (pos >= 0)
+    {
+        VM *vm = &index->vmo->vms[pos];
+        by_id = index_search(index, VMO_SORT_BY_ID, index->vmo->num_vms, vm->id, vm->name, pos, 1);
+        by_name = index_search(index, VMO_SORT_BY_NAME, index->vmo->num_vms, vm->id, vm->name, pos, 1);
+    }
+    int result = remove_vm(index->vmo, id);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    int num_vms = index->vmo->num_vms;
+    index_remove_position(index->by_id, num_vms, by_id, pos);
+    index_remove_position(index->by_name, num_vms, by_name, pos);
+    for (int s = 0; s < VMO_NUM_STATES; s++)
+    {
+        if (index_get_bit(index->state_bits[s], pos))
+        {
+            index->state_count[s]--;
+        }
+        for (int i = pos; i < num_vms; i++)
+        {
+            index_set_bit(index->state_bits[s], i, index_get_bit(index->state_bits[s], i + 1));
+        }
+        index_set_bit(index->state_bits[s], num_vms, 0);
+    }
+    return 0;
+}
+
+/*
+The vmo_index_start_vm function starts a VM with start_vm. Since start_vm may pause every other running VM,
+the running bitmap is walked afterwards to update the VMs whose state changed.
+It returns the result of start_vm, or -1 if the indexes are invalid.
+*/
+int vmo_index_start_vm(VMO_Index *index, int id)
+{
+    if (index == NULL || index->vmo == NULL)
+    {
+        return -1;
+    }
+    int result = start_vm(index->vmo, id);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    unsigned long long *running = index->state_bits[VM_STATE_RUNNING];
+    int words = (index->vmo->num_vms + VMO_INDEX_WORD_BITS - 1) / VMO_INDEX_WORD_BITS;
+    for (int w = 0; w < words; w++)
+    {
+        unsigned long long bits = running[w];
+        while (bits != 0)
+        {
+            int pos = w * VMO_INDEX_WORD_BITS + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            index_sync_state(index, pos);
+        }
+    }
+    index_sync_state(index, index_find(index, id));
+    return 0;
+}
+
+/*
+The vmo_index_stop_vm function stops a VM with stop_vm and updates its state bit.
+It returns the result of stop_vm, or -1 if the indexes are invalid.
+*/
+int vmo_index_stop_vm(VMO_Index *index, int id)
+{
+    if (index == NULL || index->vmo == NULL)
+    {
+        return -1;
+    }
+    int result = stop_vm(index->vmo, id);
+    if (result != 0)
+    {
+        return result;
+    }
+    index_sync_state(index, index_find(index, id));
+    return 0;
+}
+
+/*
+The vmo_query_init function fills in a query that matches every VM, sorted by ascending id,
+returning at most limit VMs per page and starting at the first page.
+*/
+void vmo_query_init(VMO_Query *query, int limit)
+{
+    if (query == NULL)
+    {
+        return;
+    }
+    memset(query, 0, sizeof(VMO_Query));
+    query->min_id = INT_MIN;
+    query->max_id = INT_MAX;
+    query->sort_by = VMO_SORT_BY_ID;
+    query->limit = limit;
+}
+
+static int query_matches(VMO_Index *index, const VMO_Query *query, size_t prefix_len, int pos)
+{
+    const VM *vm = &index->vmo->vms[pos];
+    if (query->state_mask != 0 && ((int)vm->state < 0 || (int)vm->state >= VMO_NUM_STATES ||
+                                   !(query->state_mask & VMO_STATE_BIT(vm->state))))
+    {
+        return 0;
+    }
+    if (vm->id < query->min_id || vm->id > query->max_id)
+    {
+        return 0;
+    }
+    if (prefix_len > 0 && strncmp(vm->name, query->name_prefix, prefix_len) != 0)
+    {
+        return 0;
+    }
+    return 1;
+}
+
+static int query_after_cursor(VMO_Index *index, const VMO_Query *query, int pos)
+{
+    if (!query->after.valid)
+    {
+        return 1;
+    }
+    int c = index_compare_key(index, query->sort_by, pos, query->after.id, query->after.name, query->after.position);
+    return query->descending ? c < 0 : c > 0;
+}
+
+static void query_set_cursor(VMO_Index *index, VMO_Cursor *cursor, int pos)
+{
+    const VM *vm = &index->vmo->vms[pos];
+    cursor->valid = 1;
+    cursor->id = vm->id;
+    memcpy(cursor->name, vm->name, sizeof(cursor->name));
+    cursor->position = pos;
+}
+
+// Compares two positions in the order the query returns them
+static int query_compare_output(VMO_Index *index, const VMO_Query *query, int a, int b)
+{
+    const VM *vm = &index->vmo->vms[b];
+    int c = index_compare_key(index, query->sort_by, a, vm->id, vm->name, b);
+    return query->descending ? -c : c;
+}
+
+// Restores the heap below entry i, where every entry comes after its children in the output order
+static void query_heap_down(VMO_Index *index, const VMO_Query *query, int *heap, int size, int i)
+{
+    for (;;)
+    {
+        int last = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < size && query_compare_output(index, query, heap[left], heap[last]) > 0)
+        {
+            last = left;
+        }
+        if (right < size && query_compare_output(index, query, heap[right], heap[last]) > 0)
+        {
+            last = right;
+        }
+        if (last == i)
+        {
+            return;
+        }
+        int swap = heap[i];
+        heap[i] = heap[last];
+        heap[last] = swap;
+        i = last;
+    }
+}
+
+/*
+Runs a query by walking the bitmaps of the requested states and keeping the first limit matches after the
+cursor in a bounded heap, so a page costs O(matches log limit) and never sorts every match. This is used when
+few VMs are in the requested states compared to the range of the sort order.
+*/
+static int query_by_state(VMO_Index *index, const VMO_Query *query, size_t prefix_len, int total, VM *results, VMO_Cursor *next)
+{
+    int capacity = query->limit < total ? query->limit : total;
+    int *heap = (int *)malloc((capacity > 0 ? capacity : 1) * sizeof(int));
+    if (heap == NULL)
+    {
+        return -2;
+    }
+    int size = 0;
+    int words = (index->vmo->num_vms + VMO_INDEX_WORD_BITS - 1) / VMO_INDEX_WORD_BITS;
+    for (int w = 0; w < words; w++)
+    {
+        unsigned long long bits = 0;
+        for (int s = 0; s < VMO_NUM_STATES; s++)
+        {
+            if (query->state_mask & VMO_STATE_BIT(s))
+            {
+                bits |= index->state_bits[s][w];
+            }
+        }
+        while (bits != 0)
+        {
+            int pos = w * VMO_INDEX_WORD_BITS + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (!query_matches(index, query, prefix_len, pos) || !query_after_cursor(index, query, pos))
+            {
+                continue;
+            }
+            if (size < capacity)
+            {
+                // Sift the new entry up past the parents that come before it
+                int i = size++;
+                while (i > 0 && query_compare_output(index, query, heap[(i - 1) / 2], pos) < 0)
+                {
+                    heap[i] = heap[(i - 1) / 2];
+                    i = (i - 1) / 2;
+                }
+                heap[i] = pos;
+            }
+            else if (size > 0 && query_compare_output(index, query, pos, heap[0]) < 0)
+            {
+                heap[0] = pos;
+                query_heap_down(index, query, heap, size, 0);
+            }
+        }
+    }
+
+    // Heap sort what is left, which puts the page in output order
+    for (int end = size - 1; end > 0; end--)
+    {
+        int swap = heap[0];
+        heap[0] = heap[end];
+        heap[end] = swap;
+        query_heap_down(index, query, heap, end, 0);
+    }
+    for (int i = 0; i < size; i++)
+    {
+        results[i] = index->vmo->vms[heap[i]];
+        query_set_cursor(index, next, heap[i]);
+    }
+    free(heap);
+    return size;
+}
+
+/*
+The vmo_query function copies at most query->limit VMs that match every predicate of the query into results,
+in the requested order. The id range (when sorting by id) or the name prefix (when sorting by name) and the cursor
+are resolved with binary searches on the matching sort order, so only that part of the order is visited.
+When the state filter is more selective than that range, the state bitmaps are used instead.
+If the page is full, next is set to its last VM and can be passed as query->after to get the following page;
+otherwise next is marked invalid. The function returns the number of VMs copied, -1 if the input is invalid
+and -2 if memory allocation fails.
+*/
+int vmo_query(VMO_Index *index, const VMO_Query *query, VM *results, VMO_Cursor *next)
+{
+    if (index == NULL || index->vmo == NULL || query == NULL || next == NULL || query->limit < 0 ||
+        (results == NULL && query->limit > 0))
+    {
+        return -1;
+    }
+    next->valid = 0;
+    if (index->vmo->num_vms == 0 || query->limit == 0 || query->min_id > query->max_id)
+    {
+        return 0;
+    }
+
+    size_t prefix_len = query->name_prefix != NULL ? strlen(query->name_prefix) : 0;
+    const int *order = query->sort_by == VMO_SORT_BY_NAME ? index->by_name : index->by_id;
+    int lo = 0;
+    int hi = index->vmo->num_vms;
+    if (query->sort_by == VMO_SORT_BY_ID)
+    {
+        lo = index_search(index, VMO_SORT_BY_ID, hi, query->min_id, NULL, INT_MIN, 1);
+        hi = index_search(index, VMO_SORT_BY_ID, hi, query->max_id, NULL, INT_MAX, 0);
+    }
+    else if (prefix_len > 0)
+    {
+        lo = index_search_prefix(index, query->name_prefix, prefix_len, 1);
+        hi = index_search_prefix(index, query->name_prefix, prefix_len, 0);
+    }
+    if (query->after.valid)
+    {
+        const VMO_Cursor *after = &query->after;
+        if (query->descending)
+        {
+            int end = index_search(index, query->sort_by, index->vmo->num_vms, after->id, after->name, after->position, 1);
+            hi = end < hi ? end : hi;
+        }
+        else
+        {
+            int start = index_search(index, query->sort_by, index->vmo->num_vms, after->id, after->name, after->position, 0);
+            lo = start > lo ? start : lo;
+        }
+    }
+
+    if (query->state_mask != 0)
+    {
+        int total = 0;
+        for (int s = 0; s < VMO_NUM_STATES; s++)
+        {
+            if (query->state_mask & VMO_STATE_BIT(s))
+            {
+                total += index->state_count[s];
+            }
+        }
+        // Picking a page out of a few matches is cheaper than walking a long range that mostly fails the state filter
+        if (total < (hi - lo) / 4)
+        {
+            int count = query_by_state(index, query, prefix_len, total, results, next);
+            if (count < query->limit)
+            {
+                next->valid = 0;
+            }
+            return count;
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < hi - lo && count < query->limit; i++)
+    {
+        int pos = order[query->descending ? hi - 1 - i : lo + i];
+        if (query_matches(index, query, prefix_len, pos))
+        {
+            results[count++] = index->vmo->vms[pos];
+            query_set_cursor(index, next, pos);
+        }
+    }
+    if (count < query->limit)
+    {
+        next->valid = 0;
+    }
+    return count;
+}
@@ -0,0 +1,73 @@
+#ifndef QUERY_H
+#define QUERY_H
+
+#include "bitmap.h"
+
+// Number of values in VM_State, used to size the per-state bitmaps
+#define VMO_NUM_STATES (VM_STATE_STOPPING + 1)
+
+// Bit for a state in VMO_Query.state_mask
+#define VMO_STATE_BIT(state) (1u << (state))
+
+// Define enumeration for the sort order of a query
+typedef enum
+{
+    VMO_SORT_BY_ID,
+    VMO_SORT_BY_NAME
+} VMO_Sort_Key;
+
+// Define a struct for the secondary indexes of a VMO system
+typedef struct
+{
+    VMO_System *vmo;
+    int *by_id;                                       // Positions in vms sorted by id, then position
+    int *by_name;                                     // Positions in vms sorted by name, then id, then position
+    unsigned long long *state_bits[VMO_NUM_STATES];   // One bit per position for every state
+    int state_count[VMO_NUM_STATES];                  // Number of bits set in each state bitmap
+    int capacity;
+} VMO_Index;
+
+// Define a struct for a pagination cursor; it identifies the last VM of the previous page
+typedef struct
+{
+    int valid;
+    int id;
+    char name[50];
+    int position;
+} VMO_Cursor;
+
+// Define a struct for a query over the VMs of an index
+typedef struct
+{
+    unsigned int state_mask; // Combination of VMO_STATE_BIT values, 0 matches every state
+    const char *name_prefix; // NULL or "" matches every name
+    int min_id;              // Inclusive id range
+    int max_id;
+    VMO_Sort_Key sort_by;
+    int descending;
+    int limit;               // Maximum number of VMs per page
+    VMO_Cursor after;        // Start after this VM, or at the beginning if not valid
+} VMO_Query;
+
+// Function to build the indexes of a VMO system
+int vmo_index_build(VMO_Index *index, VMO_System *vmo);
+
+// Function to release the memory owned by the indexes (the VMO system itself is left untouched)
+void vmo_index_free(VMO_Index *index);
+
+// Functions that call the matching bitmap.h function and keep the indexes up to date
+int vmo_index_add_vm(VMO_Index *index, char *name);
+int vmo_index_remove_vm(VMO_Index *index, int id);
+int vmo_index_start_vm(VMO_Index *index, int id);
+int vmo_index_stop_vm(VMO_Index *index, int id);
+
+// Function to pick up changes made to the VMO system directly through bitmap.h or another layer
+int vmo_index_refresh(VMO_Index *index);
+
+// Function to initialize a query that matches every VM, sorted by ascending id
+void vmo_query_init(VMO_Query *query, int limit);
+
+// Function to run a query, copying one page of matching VMs into results and setting the cursor for the next page
+int vmo_query(VMO_Index *index, const VMO_Query *query, VM *results, VMO_Cursor *next);
+
+#endif
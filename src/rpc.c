@@ -0,0 +1,607 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // For accept4
+#endif
+
+#include "rpc.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define VMO_RPC_MAX_EVENTS 64
+
+static int rpc_make_address(struct sockaddr_un *addr, const char *path)
+{
+    if (path == NULL || strlen(path) >= sizeof(addr->sun_path))
+    {
+        return -1;
+    }
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+// Runs one request against the VMO system of the server and returns its result
+static int32_t rpc_execute(VMO_Rpc_Server *server, const VMO_Rpc_Request *request, const char *name)
+{
+    switch (request->op)
+    {
+    case VMO_RPC_INIT_VMO_SYSTEM:
+    {
+        if (!server->allow_init || request->arg < 0 || request->arg > VMO_RPC_MAX_INIT_VMS)
+        {
+            return -1;
+        }
+        // Build the new system first, so the current VMs are kept if that fails
+        VMO_System fresh = init_vmo_system(request->arg);
+        if (fresh.vms == NULL && request->arg > 0)
+        {
+            return -1;
+        }
+        free(server->vmo->vms);
+        *server->vmo = fresh;
+        return server->vmo->num_vms;
+    }
+    case VMO_RPC_ADD_VM:
+    {
+        if (request->flags & VMO_RPC_FLAG_NULL_NAME)
+        {
+            return add_vm(server->vmo, NULL);
+        }
+        char buffer[256];
+        memcpy(buffer, name, request->name_len);
+        buffer[request->name_len] = '\0';
+        return add_vm(server->vmo, buffer);
+    }
+    case VMO_RPC_REMOVE_VM:
+        return remove_vm(server->vmo, request->arg);
+    case VMO_RPC_START_VM:
+        return start_vm(server->vmo, request->arg);
+    case VMO_RPC_STOP_VM:
+        return stop_vm(server->vmo, request->arg);
+    case VMO_RPC_GET_VM_STATE:
+        return get_vm_state(server->vmo, request->arg);
+    default:
+        // Unknown operation
+        return -1;
+    }
+}
+
+static void rpc_close_conn(VMO_Rpc_Server *server, VMO_Rpc_Conn *conn)
+{
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    if (conn->prev != NULL)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        server->conns = conn->next;
+    }
+    if (conn->next != NULL)
+    {
+        conn->next->prev = conn->prev;
+    }
+    free(conn);
+}
+
+static void rpc_watch(VMO_Rpc_Server *server, VMO_Rpc_Conn *conn, uint32_t events)
+{
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = conn;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+}
+
+/*
+Writes the responses of a connection with as few system calls as possible. If the socket is full, the
+connection is only watched for writability until the rest has gone out, so a client that does not read its
+results cannot make the server buffer without limit. MSG_NOSIGNAL turns a client that went away into an EPIPE
+error for this connection, instead of a SIGPIPE that would end the whole process. Returns -1 if the connection
+failed.
+*/
+static int rpc_write_out(VMO_Rpc_Server *server, VMO_Rpc_Conn *conn)
+{
+    while (conn->out_pos < conn->out_len)
+    {
+        ssize_t n = send(conn->fd, conn->out + conn->out_pos, conn->out_len - conn->out_pos, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (!conn->blocked)
+                {
+                    conn->blocked = 1;
+                    rpc_watch(server, conn, EPOLLOUT);
+                }
+                return 0;
+            }
+            return -1;
+        }
+        conn->out_pos += (int)n;
+    }
+    conn->out_len = 0;
+    conn->out_pos = 0;
+    if (conn->blocked)
+    {
+        conn->blocked = 0;
+        rpc_watch(server, conn, EPOLLIN);
+    }
+    return 0;
+}
+
+/*
+Reads whatever the client has sent, runs every complete request in the buffer and answers them all with a
+single write. A request is at least twice the size of its response, so the responses to a full input buffer
+always fit in the output buffer. Returns -1 if the connection was closed or failed.
+*/
+static int rpc_read_in(VMO_Rpc_Server *server, VMO_Rpc_Conn *conn)
+{
+    ssize_t n = read(conn->fd, conn->in + conn->in_len, VMO_RPC_BUFFER_SIZE - conn->in_len);
+    if (n == 0)
+    {
+        return -1;
+    }
+    if (n < 0)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    }
+    conn->in_len += (int)n;
+
+    int pos = 0;
+    while (conn->in_len - pos >= (int)sizeof(VMO_Rpc_Request))
+    {
+        VMO_Rpc_Request request;
+        memcpy(&request, conn->in + pos, sizeof(VMO_Rpc_Request));
+        int size = (int)sizeof(VMO_Rpc_Request) + request.name_len;
+        if (conn->in_len - pos < size)
+        {
+            break;
+        }
+        int32_t result = rpc_execute(server, &request, conn->in + pos + sizeof(VMO_Rpc_Request));
+        memcpy(conn->out + conn->out_len, &result, sizeof(int32_t));
+        conn->out_len += sizeof(int32_t);
+        pos += size;
+    }
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    return rpc_write_out(server, conn);
+}
+
+static void rpc_accept(VMO_Rpc_Server *server)
+{
+    for (;;)
+    {
+        int fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        VMO_Rpc_Conn *conn = (VMO_Rpc_Conn *)malloc(sizeof(VMO_Rpc_Conn));
+        if (conn == NULL)
+        {
+            close(fd);
+            continue;
+        }
+        conn->fd = fd;
+        conn->blocked = 0;
+        conn->in_len = 0;
+        conn->out_len = 0;
+        conn->out_pos = 0;
+        conn->prev = NULL;
+        conn->next = server->conns;
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.ptr = conn;
+        if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0)
+        {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        if (server->conns != NULL)
+        {
+            server->conns->prev = conn;
+        }
+        server->conns = conn;
+    }
+}
+
+// Removes the socket file at the address if it is left over from a server that is no longer listening
+static void rpc_remove_stale_socket(const struct sockaddr_un *addr)
+{
+    struct stat st;
+    if (lstat(addr->sun_path, &st) != 0 || !S_ISSOCK(st.st_mode))
+    {
+        return;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return;
+    }
+    if (connect(fd, (const struct sockaddr *)addr, sizeof(struct sockaddr_un)) != 0 && errno == ECONNREFUSED)
+    {
+        unlink(addr->sun_path);
+    }
+    close(fd);
+}
+
+/*
+The vmo_rpc_server_init function creates a server for a VMO system on a Unix domain socket at the given path.
+A socket file left over from a server that is no longer running is replaced, but any other file at the path,
+including the socket of a running server, makes the function fail. The server does not take ownership of the
+VMO system, except that a remote init_vmo_system call, if allowed with allow_init, replaces its VMs.
+Returns 0 on success, -1 if the input is invalid and -2 if the socket could not be set up.
+*/
+int vmo_rpc_server_init(VMO_Rpc_Server *server, VMO_System *vmo, const char *path)
+{
+    struct sockaddr_un addr;
+    if (server == NULL || vmo == NULL || rpc_make_address(&addr, path) != 0)
+    {
+        return -1;
+    }
+    memset(server, 0, sizeof(VMO_Rpc_Server));
+    server->vmo = vmo;
+    server->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server->epoll_fd < 0 || server->stop_fd < 0 || server->listen_fd < 0)
+    {
+        vmo_rpc_server_free(server);
+        return -2;
+    }
+
+    rpc_remove_stale_socket(&addr);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = NULL;
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->listen_fd, SOMAXCONN) != 0 ||
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event) != 0)
+    {
+        vmo_rpc_server_free(server);
+        return -2;
+    }
+    // The stop eventfd is told apart from the listening socket by pointing at the server itself
+    event.data.ptr = server;
+    if (epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->stop_fd, &event) != 0)
+    {
+        vmo_rpc_server_free(server);
+        return -2;
+    }
+    return 0;
+}
+
+/*
+The vmo_rpc_server_run function waits for events on all sockets and serves requests on the calling thread
+until vmo_rpc_server_stop is called. Every request runs to completion before the next one is read, so the
+VMO system sees the calls one at a time. Returns 0 when stopped and -1 if the server is invalid.
+*/
+int vmo_rpc_server_run(VMO_Rpc_Server *server)
+{
+    if (server == NULL || server->epoll_fd <= 0)
+    {
+        return -1;
+    }
+    struct epoll_event events[VMO_RPC_MAX_EVENTS];
+    server->running = 1;
+    while (server->running)
+    {
+        int n = epoll_wait(server->epoll_fd, events, VMO_RPC_MAX_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            void *ptr = events[i].data.ptr;
+            if (ptr == NULL)
+            {
+                rpc_accept(server);
+                continue;
+            }
+            if (ptr == server)
+            {
+                server->running = 0;
+                continue;
+            }
+            VMO_Rpc_Conn *conn = (VMO_Rpc_Conn *)ptr;
+            int result = 0;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                result = conn->blocked ? -1 : rpc_read_in(server, conn);
+            }
+            else if (events[i].events & EPOLLOUT)
+            {
+                result = rpc_write_out(server, conn);
+            }
+            else if (events[i].events & EPOLLIN)
+            {
+                result = rpc_read_in(server, conn);
+            }
+            if (result != 0)
+            {
+                rpc_close_conn(server, conn);
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+The vmo_rpc_server_stop function wakes the server through an eventfd so that vmo_rpc_server_run returns
+after the events it is handling. It only writes to a file descriptor, so it is safe to call from any thread.
+*/
+void vmo_rpc_server_stop(VMO_Rpc_Server *server)
+{
+    if (server == NULL || server->stop_fd <= 0)
+    {
+        return;
+    }
+    uint64_t one = 1;
+    ssize_t n = write(server->stop_fd, &one, sizeof(one));
+    (void)n;
+}
+
+/*
+The vmo_rpc_server_free function closes every connection and socket of the server.
+The socket file is left in place; vmo_rpc_server_init replaces it on the next start.
+*/
+void vmo_rpc_server_free(VMO_Rpc_Server *server)
+{
+    if (server == NULL)
+    {
+        return;
+    }
+    while (server->conns != NULL)
+    {
+        rpc_close_conn(server, server->conns);
+    }
+    if (server->listen_fd > 0)
+    {
+        close(server->listen_fd);
+    }
+    if (server->stop_fd > 0)
+    {
+        close(server->stop_fd);
+    }
+    if (server->epoll_fd > 0)
+    {
+        close(server->epoll_fd);
+    }
+    memset(server, 0, sizeof(VMO_Rpc_Server));
+}
+
+/*
+The vmo_rpc_connect function connects a client to the server listening at the given path.
+Returns 0 on success, -1 if the input is invalid and VMO_RPC_TRANSPORT_ERROR if the connection fails.
+*/
+int vmo_rpc_connect(VMO_Rpc_Client *client, const char *path)
+{
+    struct sockaddr_un addr;
+    if (client == NULL || rpc_make_address(&addr, path) != 0)
+    {
+        return -1;
+    }
+    client->pending = 0;
+    client->out_len = 0;
+    client->in_len = 0;
+    client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (client->fd < 0)
+    {
+        return VMO_RPC_TRANSPORT_ERROR;
+    }
+    if (connect(client->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(client->fd);
+        client->fd = -1;
+        return VMO_RPC_TRANSPORT_ERROR;
+    }
+    return 0;
+}
+
+/*
+The vmo_rpc_close function closes the connection of a client. Results that were not received are lost.
+*/
+void vmo_rpc_close(VMO_Rpc_Client *client)
+{
+    if (client == NULL || client->fd < 0)
+    {
+        return;
+    }
+    close(client->fd);
+    client->fd = -1;
+}
+
+/*
+The vmo_rpc_flush function writes every queued request to the socket. If the server has gone away this fails
+with EPIPE rather than raising SIGPIPE. Returns 0 on success and VMO_RPC_TRANSPORT_ERROR if the connection failed.
+*/
+int vmo_rpc_flush(VMO_Rpc_Client *client)
+{
+    if (client == NULL || client->fd < 0)
+    {
+        return VMO_RPC_TRANSPORT_ERROR;
+    }
+    int pos = 0;
+    while (pos < client->out_len)
+    {
+        ssize_t n = send(client->fd, client->out + pos, client->out_len - pos, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return VMO_RPC_TRANSPORT_ERROR;
+        }
+        pos += (int)n;
+    }
+    client->out_len = 0;
+    return 0;
+}
+
+/*
+The vmo_rpc_send function queues a request in the client buffer, writing the buffer out when it is full.
+The name is only sent for VMO_RPC_ADD_VM; a NULL name is sent as a flag, so the server calls add_vm with NULL.
+At most VMO_RPC_MAX_PIPELINE requests can wait for their results, so that the server never has to hold back
+responses the client is not reading. Returns 0 on success, -1 if the client is invalid, VMO_RPC_BUSY if the
+pipeline is full and VMO_RPC_TRANSPORT_ERROR if the connection failed.
+*/
+int vmo_rpc_send(VMO_Rpc_Client *client, VMO_Rpc_Op op, int arg, const char *name)
+{
+    if (client == NULL)
+    {
+        return -1;
+    }
+    if (client->pending >= VMO_RPC_MAX_PIPELINE)
+    {
+        return VMO_RPC_BUSY;
+    }
+    VMO_Rpc_Request request;
+    request.op = (uint8_t)op;
+    request.name_len = 0;
+    request.flags = 0;
+    request.arg = arg;
+    if (op == VMO_RPC_ADD_VM && name == NULL)
+    {
+        request.flags = VMO_RPC_FLAG_NULL_NAME;
+    }
+    else if (op == VMO_RPC_ADD_VM)
+    {
+        // Longer names are cut to 255 bytes, which add_vm still rejects as too long
+        size_t len = strlen(name);
+        request.name_len = (uint8_t)(len < 255 ? len : 255);
+    }
+    int size = (int)sizeof(VMO_Rpc_Request) + request.name_len;
+    if (client->out_len + size > VMO_RPC_BUFFER_SIZE && vmo_rpc_flush(client) != 0)
+    {
+        return VMO_RPC_TRANSPORT_ERROR;
+    }
+    memcpy(client->out + client->out_len, &request, sizeof(VMO_Rpc_Request));
+    if (request.name_len > 0)
+    {
+        memcpy(client->out + client->out_len + sizeof(VMO_Rpc_Request), name, request.name_len);
+    }
+    client->out_len += size;
+    client->pending++;
+    return 0;
+}
+
+/*
+The vmo_rpc_receive function flushes the queued requests and blocks until the results of the oldest count
+of them have arrived, storing them in order in results. Returns 0 on success, -1 if more results are asked
+for than are pending, and VMO_RPC_TRANSPORT_ERROR if the connection failed.
+*/
+int vmo_rpc_receive(VMO_Rpc_Client *client, int *results, int count)
+{
+    if (client == NULL || results == NULL || count < 0 || count > client->pending)
+    {
+        return -1;
+    }
+    if (vmo_rpc_flush(client) != 0)
+    {
+        return VMO_RPC_TRANSPORT_ERROR;
+    }
+    int needed = count * (int)sizeof(int32_t);
+    while (client->in_len < needed)
+    {
+        ssize_t n = read(client->fd, client->in + client->in_len, sizeof(client->in) - client->in_len);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return VMO_RPC_TRANSPORT_ERROR;
+        }
+        client->in_len += (int)n;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        int32_t result;
+        memcpy(&result, client->in + i * sizeof(int32_t), sizeof(int32_t));
+        results[i] = result;
+    }
+    memmove(client->in, client->in + needed, client->in_len - needed);
+    client->in_len -= needed;
+    client->pending -= count;
+    return 0;
+}
+
+// Sends one request and waits for its result; the results of queued requests must be received first
+static int rpc_call(VMO_Rpc_Client *client, VMO_Rpc_Op op, int arg, const char *name)
+{
+    if (client == NULL)
+    {
+        return -1;
+    }
+    if (client->pending > 0)
+    {
+        return VMO_RPC_BUSY;
+    }
+    int result = vmo_rpc_send(client, op, arg, name);
+    if (result != 0)
+    {
+        return result;
+    }
+    if (vmo_rpc_receive(client, &result, 1) != 0)
+    {
+        return VMO_RPC_TRANSPORT_ERROR;
+    }
+    return result;
+}
+
+/*
+The functions below make one remote call each and return the same result as the bitmap.h function they
+mirror, VMO_RPC_TRANSPORT_ERROR if the connection failed, or VMO_RPC_BUSY if requests queued with
+vmo_rpc_send are still waiting for vmo_rpc_receive. vmo_rpc_init_vmo_system replaces the VMO system
+of the server and returns its new number of VMs, or -1 if the server does not allow it or num_vms is negative
+or above VMO_RPC_MAX_INIT_VMS. vmo_rpc_get_vm_state returns VM_STATE_STOPPED if the
+call failed, as get_vm_state does for any VM it cannot find.
+*/
+int vmo_rpc_init_vmo_system(VMO_Rpc_Client *client, int num_vms)
+{
+    return rpc_call(client, VMO_RPC_INIT_VMO_SYSTEM, num_vms, NULL);
+}
+
+int vmo_rpc_add_vm(VMO_Rpc_Client *client, char *name)
+{
+    return rpc_call(client, VMO_RPC_ADD_VM, 0, name);
+}
+
+int vmo_rpc_remove_vm(VMO_Rpc_Client *client, int id)
+{
+    return rpc_call(client, VMO_RPC_REMOVE_VM, id, NULL);
+}
+
+int vmo_rpc_start_vm(VMO_Rpc_Client *client, int id)
+{
+    return rpc_call(client, VMO_RPC_START_VM, id, NULL);
+}
+
+int vmo_rpc_stop_vm(VMO_Rpc_Client *client, int id)
+{
+    return rpc_call(client, VMO_RPC_STOP_VM, id, NULL);
+}
+
+VM_State vmo_rpc_get_vm_state(VMO_Rpc_Client *client, int id)
+{
+    int result = rpc_call(client, VMO_RPC_GET_VM_STATE, id, NULL);
+    return result >= 0 ? (VM_State)result : VM_STATE_STOPPED;
+}
@@ -0,0 +1,124 @@
+#ifndef RPC_H
+#define RPC_H
+
+#include <stdint.h>
+
+#include "bitmap.h"
+
+/*
+Wire protocol: every request is an 8 byte header, followed by name_len bytes of name for VMO_RPC_ADD_VM.
+Every response is the 4 byte result of the call. Both use host byte order, since the socket is local.
+Responses are sent in request order, so a client can pipeline many requests before reading the results.
+VMO_RPC_INIT_VMO_SYSTEM frees the vms array of the served system, so it is refused unless the server sets
+allow_init, which must stay off while an index, snapshot store or simulation is attached to that system.
+*/
+
+// Define enumeration for the calls that can be made over the socket, one per function in bitmap.h
+typedef enum
+{
+    VMO_RPC_INIT_VMO_SYSTEM,
+    VMO_RPC_ADD_VM,
+    VMO_RPC_REMOVE_VM,
+    VMO_RPC_START_VM,
+    VMO_RPC_STOP_VM,
+    VMO_RPC_GET_VM_STATE
+} VMO_Rpc_Op;
+
+// Define a struct for the header of a request
+typedef struct
+{
+    uint8_t op;
+    uint8_t name_len;
+    uint16_t flags; // Combination of VMO_RPC_FLAG_* values
+    int32_t arg;
+} VMO_Rpc_Request;
+
+// Flag for VMO_RPC_ADD_VM requests whose name is NULL; no name bytes follow the header
+#define VMO_RPC_FLAG_NULL_NAME 0x1
+
+// Size of the per-connection buffers, and the most requests a client may have in flight
+#define VMO_RPC_BUFFER_SIZE 65536
+#define VMO_RPC_MAX_PIPELINE 1024
+
+// Largest system a client may ask for with VMO_RPC_INIT_VMO_SYSTEM
+#define VMO_RPC_MAX_INIT_VMS (1 << 20)
+
+// Result returned by the client functions when the connection fails
+#define VMO_RPC_TRANSPORT_ERROR (-100)
+
+// Result returned by the client functions when the pipeline is full, or by a blocking call while requests are queued
+#define VMO_RPC_BUSY (-101)
+
+// Define a struct for a client connection of the server
+typedef struct VMO_Rpc_Conn
+{
+    int fd;
+    struct VMO_Rpc_Conn *prev;
+    struct VMO_Rpc_Conn *next;
+    int blocked; // Set while waiting for the socket to accept the rest of out
+    int in_len;
+    int out_len;
+    int out_pos;
+    char in[VMO_RPC_BUFFER_SIZE];
+    char out[VMO_RPC_BUFFER_SIZE];
+} VMO_Rpc_Conn;
+
+// Define a struct for a server that serves one VMO system over a Unix domain socket
+typedef struct
+{
+    VMO_System *vmo;
+    int listen_fd;
+    int epoll_fd;
+    int stop_fd;
+    int running;
+    int allow_init; // Set after vmo_rpc_server_init to let clients replace the VMO system (off by default)
+    VMO_Rpc_Conn *conns;
+} VMO_Rpc_Server;
+
+// Define a struct for a client of the server
+typedef struct
+{
+    int fd;
+    int pending;
+    int out_len;
+    int in_len;
+    char out[VMO_RPC_BUFFER_SIZE];
+    char in[VMO_RPC_MAX_PIPELINE * sizeof(int32_t)];
+} VMO_Rpc_Client;
+
+// Function to create a server for a VMO system listening on the given socket path
+int vmo_rpc_server_init(VMO_Rpc_Server *server, VMO_System *vmo, const char *path);
+
+// Function to serve requests until vmo_rpc_server_stop is called
+int vmo_rpc_server_run(VMO_Rpc_Server *server);
+
+// Function to make vmo_rpc_server_run return; this may be called from any thread
+void vmo_rpc_server_stop(VMO_Rpc_Server *server);
+
+// Function to close the server and all of its connections
+void vmo_rpc_server_free(VMO_Rpc_Server *server);
+
+// Function to connect a client to a server
+int vmo_rpc_connect(VMO_Rpc_Client *client, const char *path);
+
+// Function to close a client connection
+void vmo_rpc_close(VMO_Rpc_Client *client);
+
+// Function to queue a request without waiting for its result
+int vmo_rpc_send(VMO_Rpc_Client *client, VMO_Rpc_Op op, int arg, const char *name);
+
+// Function to send every queued request to the server
+int vmo_rpc_flush(VMO_Rpc_Client *client);
+
+// Function to wait for the results of the oldest count queued requests
+int vmo_rpc_receive(VMO_Rpc_Client *client, int *results, int count);
+
+// Functions that make one call to the server and wait for its result, mirroring bitmap.h
+int vmo_rpc_init_vmo_system(VMO_Rpc_Client *client, int num_vms);
+int vmo_rpc_add_vm(VMO_Rpc_Client *client, char *name);
+int vmo_rpc_remove_vm(VMO_Rpc_Client *client, int id);
+int vmo_rpc_start_vm(VMO_Rpc_Client *client, int id);
+int vmo_rpc_stop_vm(VMO_Rpc_Client *client, int id);
+VM_State vmo_rpc_get_vm_state(VMO_Rpc_Client *client, int id);
+
+#endif
@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rpc.h"
+
+/*
+Latency and throughput benchmark for the RPC server. It starts a server on its own thread, connects a number of
+client threads and has each of them send batches of pipelined get_vm_state calls (with one start_vm per batch)
+for a fixed time. It prints the total calls per second and the round-trip time of a batch.
+
+Usage: rpcbench [clients] [batch size] [seconds] [number of VMs]
+*/
+
+#define RPCBENCH_MAX_SAMPLES 1000000
+
+typedef struct
+{
+    const char *path;
+    int batch;
+    int num_vms;
+    double seconds;
+    long long calls;
+    int num_samples;
+    double *samples;
+} Bench_Client;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : (x > y);
+}
+
+static void *bench_serve(void *server)
+{
+    vmo_rpc_server_run((VMO_Rpc_Server *)server);
+    return NULL;
+}
+
+static void *bench_client(void *arg)
+{
+    Bench_Client *bench = (Bench_Client *)arg;
+    VMO_Rpc_Client *client = (VMO_Rpc_Client *)malloc(sizeof(VMO_Rpc_Client));
+    int *results = (int *)malloc(bench->batch * sizeof(int));
+    if (client == NULL || results == NULL || vmo_rpc_connect(client, bench->path) != 0)
+    {
+        free(client);
+        free(results);
+        return NULL;
+    }
+
+    double end = bench_now() + bench->seconds;
+    int id = 0;
+    while (bench_now() < end)
+    {
+        double start = bench_now();
+        vmo_rpc_send(client, VMO_RPC_START_VM, id, NULL);
+        for (int i = 1; i < bench->batch; i++)
+        {
+            vmo_rpc_send(client, VMO_RPC_GET_VM_STATE, (id + i) % bench->num_vms, NULL);
+        }
+        if (vmo_rpc_receive(client, results, bench->batch) != 0)
+        {
+            break;
+        }
+        if (bench->num_samples < RPCBENCH_MAX_SAMPLES)
+        {
+            bench->samples[bench->num_samples++] = bench_now() - start;
+        }
+        bench->calls += bench->batch;
+        id = (id + bench->batch) % bench->num_vms;
+    }
+    vmo_rpc_close(client);
+    free(client);
+    free(results);
+    return NULL;
+}
+
+int main(int argc, char **argv)
+{
+    int num_clients = argc > 1 ? atoi(argv[1]) : 4;
+    int batch = argc > 2 ? atoi(argv[2]) : 256;
+    double seconds = argc > 3 ? atof(argv[3]) : 3.0;
+    int num_vms = argc > 4 ? atoi(argv[4]) : 1024;
+    if (num_clients < 1 || batch < 1 || batch > VMO_RPC_MAX_PIPELINE || seconds <= 0 || num_vms < 1)
+    {
+        fprintf(stderr, "usage: %s [clients] [batch size <= %d] [seconds] [number of VMs]\n", argv[0], VMO_RPC_MAX_PIPELINE);
+        return 1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/vmo_rpcbench_%d.sock", (int)getpid());
+    VMO_System vmo = init_vmo_system(num_vms);
+    VMO_Rpc_Server server;
+    if (vmo_rpc_server_init(&server, &vmo, path) != 0)
+    {
+        fprintf(stderr, "could not listen on %s\n", path);
+        return 1;
+    }
+    pthread_t server_thread;
+    pthread_create(&server_thread, NULL, bench_serve, &server);
+
+    Bench_Client *clients = (Bench_Client *)calloc(num_clients, sizeof(Bench_Client));
+    pthread_t *threads = (pthread_t *)malloc(num_clients * sizeof(pthread_t));
+    for (int c = 0; c < num_clients; c++)
+    {
+        clients[c].path = path;
+        clients[c].batch = batch;
+        clients[c].num_vms = num_vms;
+        clients[c].seconds = seconds;
+        clients[c].samples = (double *)malloc(RPCBENCH_MAX_SAMPLES * sizeof(double));
+        pthread_create(&threads[c], NULL, bench_client, &clients[c]);
+    }
+
+    long long calls = 0;
+    int num_samples = 0;
+    double *samples = NULL;
+    for (int c = 0; c < num_clients; c++)
+    {
+        pthread_join(threads[c], NULL);
+        calls += clients[c].calls;
+        double *all = (double *)realloc(samples, (num_samples + clients[c].num_samples) * sizeof(double) + 1);
+        if (all != NULL)
+        {
+            samples = all;
+            memcpy(samples + num_samples, clients[c].samples, clients[c].num_samples * sizeof(double));
+            num_samples += clients[c].num_samples;
+        }
+        free(clients[c].samples);
+    }
+    vmo_rpc_server_stop(&server);
+    pthread_join(server_thread, NULL);
+    vmo_rpc_server_free(&server);
+    unlink(path);
+
+    printf("clients %d, batch %d, VMs %d, %.1f s\n", num_clients, batch, num_vms, seconds);
+    printf("throughput: %.0f calls/s\n", calls / seconds);
+    if (num_samples > 0)
+    {
+        qsort(samples, num_samples, sizeof(double), bench_compare);
+        printf("batch round trip: p50 %.1f us, p99 %.1f us, max %.1f us\n", samples[num_samples / 2] * 1e6,
+               samples[(int)(num_samples * 0.99)] * 1e6, samples[num_samples - 1] * 1e6);
+    }
+    free(samples);
+    free(clients);
+    free(threads);
+    free(vmo.vms);
+    return 0;
+}
@@ -0,0 +1,690 @@
+#include "sim.h"
+
+#define VMO_SIM_OVERFLOW_BUCKET (VMO_SIM_WHEEL_LEVELS * VMO_SIM_WHEEL_SIZE)
+#define VMO_SIM_MIN_CAPACITY 16
+
+/*
+The lookup table maps a VM id to the index of the first VM with that id in the vms array, which is the
+same VM the linear scans in bitmap.c would find. It is an open addressing hash table that is kept at
+most half full and is rebuilt from the vms array whenever the array is shifted by a removal.
+*/
+static unsigned int sim_hash(int id, int capacity)
+{
+    return ((unsigned int)id * 2654435761u) & (unsigned int)(capacity - 1);
+}
+
+static int sim_lookup_find(VMO_Sim *sim, int id)
+{
+    unsigned int pos = sim_hash(id, sim->lookup_capacity);
+    while (sim->lookup[pos].index >= 0)
+    {
+        if (sim->lookup[pos].id == id)
+        {
+            return sim->lookup[pos].index;
+        }
+        pos = (pos + 1) & (unsigned int)(sim->lookup_capacity - 1);
+    }
+    return -1;
+}
+
+static void sim_lookup_insert(VMO_Sim *sim, int id, int index)
+{
+    unsigned int pos = sim_hash(id, sim->lookup_capacity);
+    while (sim->lookup[pos].index >= 0)
+    {
+        if (sim->lookup[pos].id == id)
+        {
+            // Keep the first VM with this id, like the linear scans do
+            return;
+        }
+        pos = (pos + 1) & (unsigned int)(sim->lookup_capacity - 1);
+    }
+    sim->lookup[pos].id = id;
+    sim->lookup[pos].index = index;
+}
+
+static int sim_lookup_rebuild(VMO_Sim *sim, int min_vms)
+{
+    int capacity = sim->lookup_capacity > 0 ? sim->lookup_capacity : VMO_SIM_MIN_CAPACITY;
+    while (capacity < 2 * min_vms)
+    {
+        capacity *= 2;
+    }
+    if (capacity != sim->lookup_capacity)
+    {
+        VMO_Sim_Slot *lookup = (VMO_Sim_Slot *)realloc(sim->lookup, capacity * sizeof(VMO_Sim_Slot));
+        if (lookup == NULL)
+        {
+            return -1;
+        }
+        sim->lookup = lookup;
+        sim->lookup_capacity = capacity;
+    }
+    for (int i = 0; i < sim->lookup_capacity; i++)
+    {
+        sim->lookup[i].index = -1;
+    }
+    for (int i = 0; i < sim->vmo->num_vms; i++)
+    {
+        sim_lookup_insert(sim, sim->vmo->vms[i].id, i);
+    }
+    return 0;
+}
+
+static int sim_reserve_vms(VMO_Sim *sim, int num_vms)
+{
+    if (num_vms <= sim->vm_capacity)
+    {
+        return 0;
+    }
+    int capacity = sim->vm_capacity > 0 ? sim->vm_capacity : VMO_SIM_MIN_CAPACITY;
+    while (capacity < num_vms)
+    {
+        capacity *= 2;
+    }
+    VMO_Sim_VM *vm_data = (VMO_Sim_VM *)realloc(sim->vm_data, capacity * sizeof(VMO_Sim_VM));
+    if (vm_data == NULL)
+    {
+        return -1;
+    }
+    sim->vm_data = vm_data;
+    int *running = (int *)realloc(sim->running, capacity * sizeof(int));
+    if (running == NULL)
+    {
+        return -1;
+    }
+    sim->running = running;
+    sim->vm_capacity = capacity;
+    return 0;
+}
+
+static void sim_rebuild_running(VMO_Sim *sim)
+{
+    sim->num_running = 0;
+    for (int i = 0; i < sim->vmo->num_vms; i++)
+    {
+        if (sim->vmo->vms[i].state == VM_STATE_RUNNING)
+        {
+            sim->vm_data[i].running_pos = sim->num_running;
+            sim->running[sim->num_running++] = i;
+        }
+        else
+        {
+            sim->vm_data[i].running_pos = -1;
+        }
+    }
+}
+
+static void sim_running_remove(VMO_Sim *sim, int index)
+{
+    int pos = sim->vm_data[index].running_pos;
+    if (pos < 0)
+    {
+        return;
+    }
+    int last = sim->running[--sim->num_running];
+    sim->running[pos] = last;
+    sim->vm_data[last].running_pos = pos;
+    sim->vm_data[index].running_pos = -1;
+}
+
+static void sim_running_add(VMO_Sim *sim, int index)
+{
+    if (sim->vm_data[index].running_pos >= 0)
+    {
+        return;
+    }
+    sim->vm_data[index].running_pos = sim->num_running;
+    sim->running[sim->num_running++] = index;
+}
+
+/*
+Pending transitions are kept in a hierarchical timer wheel: 4 levels of 256 slots, where level N holds
+timers that expire less than 256^(N+1) ticks from now, plus one overflow bucket for anything further out.
+Adding and cancelling a timer is O(1), and whenever the lower bits of the current time wrap around the
+matching slot of the next level is cascaded down. Timers are stored in a pool and linked by index, so
+millions of pending timers cost a few dozen bytes each.
+*/
+static int sim_bucket_for(VMO_Sim *sim, VMO_Tick expires)
+{
+    VMO_Tick delta = expires - sim->now;
+    for (int level = 0; level < VMO_SIM_WHEEL_LEVELS; level++)
+    {
+        int shift = VMO_SIM_WHEEL_BITS * level;
+        if (delta < ((VMO_Tick)1 << (shift + VMO_SIM_WHEEL_BITS)))
+        {
+            return level * VMO_SIM_WHEEL_SIZE + (int)((expires >> shift) & (VMO_SIM_WHEEL_SIZE - 1));
+        }
+    }
+    return VMO_SIM_OVERFLOW_BUCKET;
+}
+
+static void sim_timer_link(VMO_Sim *sim, int t)
+{
+    int bucket = sim_bucket_for(sim, sim->timers[t].expires);
+    sim->timers[t].bucket = bucket;
+    sim->timers[t].prev = -1;
+    sim->timers[t].next = sim->wheel[bucket];
+    if (sim->wheel[bucket] >= 0)
+    {
+        sim->timers[sim->wheel[bucket]].prev = t;
+    }
+    sim->wheel[bucket] = t;
+    sim->level_count[bucket / VMO_SIM_WHEEL_SIZE]++;
+}
+
+static void sim_timer_unlink(VMO_Sim *sim, int t)
+{
+    VMO_Sim_Timer *timer = &sim->timers[t];
+    if (timer->prev >= 0)
+    {
+        sim->timers[timer->prev].next = timer->next;
+    }
+    else
+    {
+        sim->wheel[timer->bucket] = timer->next;
+    }
+    if (timer->next >= 0)
+    {
+        sim->timers[timer->next].prev = timer->prev;
+    }
+    sim->level_count[timer->bucket / VMO_SIM_WHEEL_SIZE]--;
+}
+
+static int sim_timer_alloc(VMO_Sim *sim)
+{
+    if (sim->free_timer < 0)
+    {
+        int capacity = sim->timer_capacity > 0 ? sim->timer_capacity * 2 : VMO_SIM_MIN_CAPACITY;
+        VMO_Sim_Timer *timers = (VMO_Sim_Timer *)realloc(sim->timers, capacity * sizeof(VMO_Sim_Timer));
+        if (timers == NULL)
+        {
+            return -1;
+        }
+        for (int i = sim->timer_capacity; i < capacity; i++)
+        {
+            timers[i].next = i + 1 < capacity ? i + 1 : -1;
+        }
+        sim->timers = timers;
+        sim->free_timer = sim->timer_capacity;
+        sim->timer_capacity = capacity;
+    }
+    int t = sim->free_timer;
+    sim->free_timer = sim->timers[t].next;
+    return t;
+}
+
+static void sim_timer_release(VMO_Sim *sim, int t)
+{
+    sim->timers[t].next = sim->free_timer;
+    sim->free_timer = t;
+}
+
+static int sim_schedule(VMO_Sim *sim, int index, VMO_Tick ticks)
+{
+    int t = sim_timer_alloc(sim);
+    if (t < 0)
+    {
+        return -1;
+    }
+    // Saturate like vmo_sim_advance, so a huge duration cannot wrap around into the past
+    sim->timers[t].expires = sim->now + ticks < sim->now ? (VMO_Tick)-1 : sim->now + ticks;
+    sim->timers[t].vm_index = index;
+    sim_timer_link(sim, t);
+    sim->vm_data[index].timer = t;
+    sim->num_pending++;
+    return 0;
+}
+
+static void sim_cancel(VMO_Sim *sim, int index)
+{
+    int t = sim->vm_data[index].timer;
+    if (t < 0)
+    {
+        return;
+    }
+    sim_timer_unlink(sim, t);
+    sim_timer_release(sim, t);
+    sim->vm_data[index].timer = -1;
+    sim->num_pending--;
+}
+
+static void sim_set_state(VMO_Sim *sim, int index, VM_State to)
+{
+    VM_State from = sim->vmo->vms[index].state;
+    sim->vmo->vms[index].state = to;
+    if (sim->on_transition != NULL)
+    {
+        sim->on_transition(sim->ctx, sim->vmo->vms[index].id, from, to, sim->now);
+    }
+}
+
+// Finishing a boot follows start_vm: the VM runs and every other running VM is paused
+static void sim_complete_start(VMO_Sim *sim, int index)
+{
+    while (sim->num_running > 0)
+    {
+        int other = sim->running[0];
+        sim_running_remove(sim, other);
+        sim_set_state(sim, other, VM_STATE_PAUSED);
+    }
+    sim_set_state(sim, index, VM_STATE_RUNNING);
+    sim_running_add(sim, index);
+}
+
+static void sim_complete_stop(VMO_Sim *sim, int index)
+{
+    sim_set_state(sim, index, VM_STATE_STOPPED);
+}
+
+static int sim_begin_start(VMO_Sim *sim, int index)
+{
+    VMO_Tick ticks = sim->vm_data[index].boot_ticks;
+    if (ticks > 0 && sim_schedule(sim, index, ticks) != 0)
+    {
+        return -1;
+    }
+    sim_set_state(sim, index, VM_STATE_STARTING);
+    if (ticks == 0)
+    {
+        sim_complete_start(sim, index);
+    }
+    return 0;
+}
+
+static int sim_begin_stop(VMO_Sim *sim, int index)
+{
+    VMO_Tick ticks = sim->vm_data[index].shutdown_ticks;
+    if (ticks > 0 && sim_schedule(sim, index, ticks) != 0)
+    {
+        return -1;
+    }
+    sim_running_remove(sim, index);
+    sim_set_state(sim, index, VM_STATE_STOPPING);
+    if (ticks == 0)
+    {
+        sim_complete_stop(sim, index);
+    }
+    return 0;
+}
+
+static void sim_cascade(VMO_Sim *sim, int bucket)
+{
+    int t = sim->wheel[bucket];
+    sim->wheel[bucket] = -1;
+    while (t >= 0)
+    {
+        int next = sim->timers[t].next;
+        sim->level_count[bucket / VMO_SIM_WHEEL_SIZE]--;
+        sim_timer_link(sim, t);
+        t = next;
+    }
+}
+
+// Moves the clock forward by one tick and completes every transition that expires at the new time
+static int sim_tick(VMO_Sim *sim)
+{
+    sim->now++;
+    for (int level = 1; level < VMO_SIM_WHEEL_LEVELS; level++)
+    {
+        int shift = VMO_SIM_WHEEL_BITS * level;
+        if (((sim->now >> (shift - VMO_SIM_WHEEL_BITS)) & (VMO_SIM_WHEEL_SIZE - 1)) != 0)
+        {
+            break;
+        }
+        sim_cascade(sim, level * VMO_SIM_WHEEL_SIZE + (int)((sim->now >> shift) & (VMO_SIM_WHEEL_SIZE - 1)));
+        if (level == VMO_SIM_WHEEL_LEVELS - 1)
+        {
+            sim_cascade(sim, VMO_SIM_OVERFLOW_BUCKET);
+        }
+    }
+
+    int fired = 0;
+    int bucket = (int)(sim->now & (VMO_SIM_WHEEL_SIZE - 1));
+    int t = sim->wheel[bucket];
+    sim->wheel[bucket] = -1;
+    while (t >= 0)
+    {
+        int next = sim->timers[t].next;
+        int index = sim->timers[t].vm_index;
+        sim->level_count[0]--;
+        sim->num_pending--;
+        sim->vm_data[index].timer = -1;
+        sim_timer_release(sim, t);
+        if (sim->vmo->vms[index].state == VM_STATE_STARTING)
+        {
+            sim_complete_start(sim, index);
+        }
+        else if (sim->vmo->vms[index].state == VM_STATE_STOPPING)
+        {
+            sim_complete_stop(sim, index);
+        }
+        fired++;
+        t = next;
+    }
+    return fired;
+}
+
+// Returns the earliest expiry in the overflow bucket
+static VMO_Tick sim_overflow_first(VMO_Sim *sim)
+{
+    VMO_Tick first = (VMO_Tick)-1;
+    for (int t = sim->wheel[VMO_SIM_OVERFLOW_BUCKET]; t >= 0; t = sim->timers[t].next)
+    {
+        if (sim->timers[t].expires < first)
+        {
+            first = sim->timers[t].expires;
+        }
+    }
+    return first;
+}
+
+/*
+Advances the clock up to target one tick at a time, but skips straight to the next slot boundary
+whenever the lower levels of the wheel are empty, so long boot times do not cost one iteration per tick.
+When only the overflow bucket holds timers, the clock skips to just before the top level window of the
+earliest one, so even durations close to the end of time take a handful of iterations.
+If until_idle is set, the clock stops at the last completed transition instead of running on to target.
+*/
+static int sim_advance_to(VMO_Sim *sim, VMO_Tick target, int until_idle)
+{
+    int fired = 0;
+    while (sim->now < target)
+    {
+        if (sim->num_pending == 0)
+        {
+            if (!until_idle)
+            {
+                sim->now = target;
+            }
+            break;
+        }
+        int level = 0;
+        while (level < VMO_SIM_WHEEL_LEVELS && sim->level_count[level] == 0)
+        {
+            level++;
+        }
+        if (level > 0)
+        {
+            VMO_Tick skip_to = sim->now | (((VMO_Tick)1 << (VMO_SIM_WHEEL_BITS * level)) - 1);
+            if (level == VMO_SIM_WHEEL_LEVELS)
+            {
+                VMO_Tick window = sim_overflow_first(sim) & ~(((VMO_Tick)1 << (VMO_SIM_WHEEL_BITS * level)) - 1);
+                if (window - 1 > skip_to)
+                {
+                    skip_to = window - 1;
+                }
+            }
+            if (skip_to >= target)
+            {
+                sim->now = target;
+                break;
+            }
+            sim->now = skip_to;
+        }
+        fired += sim_tick(sim);
+    }
+    return fired;
+}
+
+/*
+The vmo_sim_init function attaches a discrete-event simulation to an existing VMO system. Every VM gets
+the given default boot and shutdown durations, and VMs that are already in a transitional state are
+scheduled to complete after those durations. The function returns 0 on success, -1 if the input is
+invalid and -2 if memory allocation fails.
+*/
+int vmo_sim_init(VMO_Sim *sim, VMO_System *vmo, VMO_Tick boot_ticks, VMO_Tick shutdown_ticks)
+{
+    if (sim == NULL || vmo == NULL || vmo->num_vms < 0 || (vmo->vms == NULL && vmo->num_vms > 0))
+    {
+        return -1;
+    }
+
+    memset(sim, 0, sizeof(VMO_Sim));
+    sim->vmo = vmo;
+    sim->default_boot_ticks = boot_ticks;
+    sim->default_shutdown_ticks = shutdown_ticks;
+    sim->free_timer = -1;
+    for (int i = 0; i <= VMO_SIM_OVERFLOW_BUCKET; i++)
+    {
+        sim->wheel[i] = -1;
+    }
+
+    if (sim_reserve_vms(sim, vmo->num_vms > 0 ? vmo->num_vms : 1) != 0 ||
+        sim_lookup_rebuild(sim, vmo->num_vms) != 0)
+    {
+        vmo_sim_free(sim);
+        return -2;
+    }
+    for (int i = 0; i < vmo->num_vms; i++)
+    {
+        sim->vm_data[i].boot_ticks = boot_ticks;
+        sim->vm_data[i].shutdown_ticks = shutdown_ticks;
+        sim->vm_data[i].timer = -1;
+    }
+    sim_rebuild_running(sim);
+
+    for (int i = 0; i < vmo->num_vms; i++)
+    {
+        VM_State state = vmo->vms[i].state;
+        VMO_Tick ticks = state == VM_STATE_STARTING ? boot_ticks : shutdown_ticks;
+        if (state != VM_STATE_STARTING && state != VM_STATE_STOPPING)
+        {
+            continue;
+        }
+        if (ticks == 0)
+        {
+            if (state == VM_STATE_STARTING)
+            {
+                sim_complete_start(sim, i);
+            }
+            else
+            {
+                sim_complete_stop(sim, i);
+            }
+        }
+        else if (sim_schedule(sim, i, ticks) != 0)
+        {
+            vmo_sim_free(sim);
+            return -2;
+        }
+    }
+    return 0;
+}
+
+/*
+The vmo_sim_free function releases the timers, lookup table and per-VM data of a simulation.
+VMs that are still starting or stopping keep their transitional state in the VMO system.
+*/
+void vmo_sim_free(VMO_Sim *sim)
+{
+    if (sim == NULL)
+    {
+        return;
+    }
+    free(sim->vm_data);
+    free(sim->lookup);
+    free(sim->running);
+    free(sim->timers);
+    memset(sim, 0, sizeof(VMO_Sim));
+    sim->free_timer = -1;
+}
+
+/*
+The vmo_sim_set_durations function sets how many ticks a VM takes to boot and to shut down.
+The new durations apply to transitions requested afterwards; a transition already in progress keeps
+its original completion time. Returns 0 on success, -1 if the simulation is invalid and -2 if the VM is not found.
+*/
+int vmo_sim_set_durations(VMO_Sim *sim, int id, VMO_Tick boot_ticks, VMO_Tick shutdown_ticks)
+{
+    if (sim == NULL || sim->vmo == NULL)
+    {
+        return -1;
+    }
+    int index = sim_lookup_find(sim, id);
+    if (index < 0)
+    {
+        return -2;
+    }
+    sim->vm_data[index].boot_ticks = boot_ticks;
+    sim->vm_data[index].shutdown_ticks = shutdown_ticks;
+    return 0;
+}
+
+/*
+The vmo_sim_add_vm function adds a VM with add_vm and gives it the default durations of the simulation.
+It returns the ID of the new VM, or -1 if there was an error.
+*/
+int vmo_sim_add_vm(VMO_Sim *sim, char *name)
+{
+    if (sim == NULL || sim->vmo == NULL)
+    {
+        return -1;
+    }
+    int num_vms = sim->vmo->num_vms + 1;
+    if (sim_reserve_vms(sim, num_vms) != 0)
+    {
+        return -1;
+    }
+    if (2 * num_vms > sim->lookup_capacity && sim_lookup_rebuild(sim, num_vms) != 0)
+    {
+        return -1;
+    }
+
+    int id = add_vm(sim->vmo, name);
+    if (id < 0)
+    {
+        return id;
+    }
+    int index = sim->vmo->num_vms - 1;
+    sim->vm_data[index].boot_ticks = sim->default_boot_ticks;
+    sim->vm_data[index].shutdown_ticks = sim->default_shutdown_ticks;
+    sim->vm_data[index].timer = -1;
+    sim->vm_data[index].running_pos = -1;
+    sim_lookup_insert(sim, id, index);
+    return id;
+}
+
+/*
+The vmo_sim_remove_vm function removes a VM with remove_vm, cancelling its pending transition if there is one.
+Since remove_vm shifts the array, the per-VM data is shifted with it and the lookup table and running list
+are rebuilt. It returns the result of remove_vm, or -1 if the simulation is invalid.
+*/
+int vmo_sim_remove_vm(VMO_Sim *sim, int id)
+{
+    if (sim == NULL || sim->vmo == NULL)
+    {
+        return -1;
+    }
+    int index = sim->vmo->vms != NULL ? sim_lookup_find(sim, id) : -1;
+    int result = remove_vm(sim->vmo, id);
+    if (result != 0)
+    {
+        return result;
+    }
+
+    sim_cancel(sim, index);
+    for (int i = index; i < sim->vmo->num_vms; i++)
+    {
+        sim->vm_data[i] = sim->vm_data[i + 1];
+        if (sim->vm_data[i].timer >= 0)
+        {
+            sim->timers[sim->vm_data[i].timer].vm_index = i;
+        }
+    }
+    sim_lookup_rebuild(sim, sim->vmo->num_vms);
+    sim_rebuild_running(sim);
+    return 0;
+}
+
+/*
+The vmo_sim_start_vm function is the simulated version of start_vm. A stopped VM enters VM_STATE_STARTING
+and becomes running once its boot time has elapsed, at which point other running VMs are paused. A paused VM
+resumes immediately, as in start_vm. Returns 0 on success, -1 if the system is invalid, -2 if the VM is not
+found, -3 if it is already running or starting, -4 if it is still stopping, and -5 if memory allocation fails.
+*/
+int vmo_sim_start_vm(VMO_Sim *sim, int id)
+{
+    if (sim == NULL || sim->vmo == NULL || sim->vmo->vms == NULL)
+    {
+        return -1;
+    }
+    int index = sim_lookup_find(sim, id);
+    if (index < 0)
+    {
+        return -2;
+    }
+    VM_State current_state = sim->vmo->vms[index].state;
+    if (current_state == VM_STATE_RUNNING || current_state == VM_STATE_STARTING)
+    {
+        return -3;
+    }
+    if (current_state == VM_STATE_STOPPING)
+    {
+        return -4;
+    }
+    if (current_state == VM_STATE_PAUSED)
+    {
+        sim_set_state(sim, index, VM_STATE_RUNNING);
+        sim_running_add(sim, index);
+        return 0;
+    }
+    return sim_begin_start(sim, index) == 0 ? 0 : -5;
+}
+
+/*
+The vmo_sim_stop_vm function is the simulated version of stop_vm. A running VM enters VM_STATE_STOPPING
+and becomes stopped once its shutdown time has elapsed. The error codes match stop_vm: -1 if the
+simulation is invalid, -2 if there are no VMs, -3 if the VM is not running and -4 if it is not found,
+plus -5 if memory allocation fails.
+*/
+int vmo_sim_stop_vm(VMO_Sim *sim, int id)
+{
+    if (sim == NULL || sim->vmo == NULL)
+    {
+        return -1;
+    }
+    if (!sim->vmo->vms || sim->vmo->num_vms == 0)
+    {
+        return -2;
+    }
+    int index = sim_lookup_find(sim, id);
+    if (index < 0)
+    {
+        return -4;
+    }
+    if (sim->vmo->vms[index].state != VM_STATE_RUNNING)
+    {
+        return -3;
+    }
+    return sim_begin_stop(sim, index) == 0 ? 0 : -5;
+}
+
+/*
+The vmo_sim_advance function moves simulated time forward by the given number of ticks and completes every
+transition that becomes due, in order of expiry. It returns the number of transitions completed, or -1 if the
+simulation is invalid.
+*/
+int vmo_sim_advance(VMO_Sim *sim, VMO_Tick ticks)
+{
+    if (sim == NULL || sim->vmo == NULL)
+    {
+        return -1;
+    }
+    VMO_Tick target = sim->now + ticks < sim->now ? (VMO_Tick)-1 : sim->now + ticks;
+    return sim_advance_to(sim, target, 0);
+}
+
+/*
+The vmo_sim_run function keeps advancing simulated time until no transitions are pending. The clock is left
+at the time of the last completed transition. It returns the number of transitions completed, or -1 if the
+simulation is invalid.
+*/
+int vmo_sim_run(VMO_Sim *sim)
+{
+    if (sim == NULL || sim->vmo == NULL)
+    {
+        return -1;
+    }
+    return sim_advance_to(sim, (VMO_Tick)-1, 1);
+}
@@ -0,0 +1,98 @@
+#ifndef SIM_H
+#define SIM_H
+
+#include "bitmap.h"
+
+// Number of slots per timer wheel level and number of levels (4 levels of 256 slots cover 2^32 ticks)
+#define VMO_SIM_WHEEL_BITS 8
+#define VMO_SIM_WHEEL_SIZE (1 << VMO_SIM_WHEEL_BITS)
+#define VMO_SIM_WHEEL_LEVELS 4
+
+// Simulated time, measured in ticks (the caller decides what a tick is, e.g. one millisecond)
+typedef unsigned long long VMO_Tick;
+
+// Callback invoked every time a simulated VM changes state; it must not call back into the simulation
+typedef void (*VMO_Sim_Transition_Fn)(void *ctx, int id, VM_State from, VM_State to, VMO_Tick now);
+
+// Define a struct for a pending timer; timers live in a pool and are linked by index
+typedef struct
+{
+    VMO_Tick expires;
+    int vm_index;
+    int next;
+    int prev;
+    int bucket;
+} VMO_Sim_Timer;
+
+// Define a struct for the per-VM simulation data, kept parallel to the vms array
+typedef struct
+{
+    VMO_Tick boot_ticks;
+    VMO_Tick shutdown_ticks;
+    int timer;
+    int running_pos;
+} VMO_Sim_VM;
+
+// Define a struct for the id -> array index lookup table
+typedef struct
+{
+    int id;
+    int index;
+} VMO_Sim_Slot;
+
+// Define a struct for the discrete-event simulation of a VMO system
+typedef struct
+{
+    VMO_System *vmo;
+    VMO_Tick now;
+    VMO_Tick default_boot_ticks;
+    VMO_Tick default_shutdown_ticks;
+
+    VMO_Sim_VM *vm_data;
+    int vm_capacity;
+
+    VMO_Sim_Slot *lookup;
+    int lookup_capacity;
+
+    int *running;
+    int num_running;
+
+    VMO_Sim_Timer *timers;
+    int timer_capacity;
+    int free_timer;
+    int num_pending;
+    int wheel[VMO_SIM_WHEEL_LEVELS * VMO_SIM_WHEEL_SIZE + 1];
+    int level_count[VMO_SIM_WHEEL_LEVELS + 1];
+
+    VMO_Sim_Transition_Fn on_transition;
+    void *ctx;
+} VMO_Sim;
+
+// Function to attach a simulation to a VMO system with default boot and shutdown durations
+int vmo_sim_init(VMO_Sim *sim, VMO_System *vmo, VMO_Tick boot_ticks, VMO_Tick shutdown_ticks);
+
+// Function to release all memory owned by a simulation (the VMO system itself is left untouched)
+void vmo_sim_free(VMO_Sim *sim);
+
+// Function to set the boot and shutdown durations of a single virtual machine
+int vmo_sim_set_durations(VMO_Sim *sim, int id, VMO_Tick boot_ticks, VMO_Tick shutdown_ticks);
+
+// Function to add a new virtual machine through the simulation
+int vmo_sim_add_vm(VMO_Sim *sim, char *name);
+
+// Function to remove a virtual machine through the simulation, cancelling its pending transition
+int vmo_sim_remove_vm(VMO_Sim *sim, int id);
+
+// Function to request a virtual machine to start (enters VM_STATE_STARTING)
+int vmo_sim_start_vm(VMO_Sim *sim, int id);
+
+// Function to request a virtual machine to stop (enters VM_STATE_STOPPING)
+int vmo_sim_stop_vm(VMO_Sim *sim, int id);
+
+// Function to advance simulated time by a number of ticks, returns the number of transitions completed
+int vmo_sim_advance(VMO_Sim *sim, VMO_Tick ticks);
+
+// Function to run the simulation until no transitions are pending, returns the number of transitions completed
+int vmo_sim_run(VMO_Sim *sim);
+
+#endif
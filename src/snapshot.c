@@ -0,0 +1,407 @@
+#include "snapshot.h"
+
+/*
+The store keeps its current version as a table of fixed-size chunks that mirrors the vms array of the
+VMO system. Acquiring a snapshot only takes a reference on that table. The next change made by the writer
+then clones the table (a pointer per chunk) and copies just the chunks it modifies, so the chunks that did
+not change stay shared between every snapshot and the current version. Reference counts are atomic so
+readers can release snapshots from any thread without taking the store lock.
+*/
+static int snapshot_is_shared(int *refs)
+{
+    return __atomic_load_n(refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+static void snapshot_chunk_release(VMO_Chunk *chunk)
+{
+    if (__atomic_sub_fetch(&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        free(chunk);
+    }
+}
+
+static int snapshot_vm_equal(const VM *a, const VM *b)
+{
+    return a->id == b->id && a->state == b->state && strncmp(a->name, b->name, sizeof(a->name)) == 0;
+}
+
+// Makes the current version private to the writer, cloning its chunk table if a snapshot still holds it
+static int store_own_table(VMO_Store *store)
+{
+    VMO_Snapshot *current = store->current;
+    if (!snapshot_is_shared(&current->refs))
+    {
+        return 0;
+    }
+    VMO_Snapshot *copy = (VMO_Snapshot *)malloc(sizeof(VMO_Snapshot));
+    if (copy == NULL)
+    {
+        return -1;
+    }
+    int capacity = current->chunk_capacity > 0 ? current->chunk_capacity : 1;
+    copy->chunks = (VMO_Chunk **)malloc(capacity * sizeof(VMO_Chunk *));
+    if (copy->chunks == NULL)
+    {
+        free(copy);
+        return -1;
+    }
+    for (int i = 0; i < current->num_chunks; i++)
+    {
+        copy->chunks[i] = current->chunks[i];
+        __atomic_add_fetch(&copy->chunks[i]->refs, 1, __ATOMIC_RELAXED);
+    }
+    copy->refs = 1;
+    copy->num_vms = current->num_vms;
+    copy->num_chunks = current->num_chunks;
+    copy->chunk_capacity = capacity;
+    store->current = copy;
+    vmo_snapshot_release(current);
+    return 0;
+}
+
+// Makes a chunk of the current version private to the writer, copying it if another version shares it
+static VMO_Chunk *store_own_chunk(VMO_Store *store, int c)
+{
+    VMO_Chunk *chunk = store->current->chunks[c];
+    if (!snapshot_is_shared(&chunk->refs))
+    {
+        return chunk;
+    }
+    VMO_Chunk *copy = (VMO_Chunk *)malloc(sizeof(VMO_Chunk));
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+    copy->refs = 1;
+    memcpy(copy->vms, chunk->vms, sizeof(chunk->vms));
+    store->current->chunks[c] = copy;
+    snapshot_chunk_release(chunk);
+    return copy;
+}
+
+// Grows or shrinks the chunk table of the (already private) current version to hold num_vms VMs
+static int store_resize(VMO_Store *store, int num_vms)
+{
+    VMO_Snapshot *current = store->current;
+    int needed = (num_vms + VMO_SNAPSHOT_CHUNK_SIZE - 1) / VMO_SNAPSHOT_CHUNK_SIZE;
+    while (current->num_chunks > needed)
+    {
+        snapshot_chunk_release(current->chunks[--current->num_chunks]);
+    }
+    if (needed > current->chunk_capacity)
+    {
+        int capacity = current->chunk_capacity > 0 ? current->chunk_capacity * 2 : 4;
+        while (capacity < needed)
+        {
+            capacity *= 2;
+        }
+        VMO_Chunk **chunks = (VMO_Chunk **)realloc(current->chunks, capacity * sizeof(VMO_Chunk *));
+        if (chunks == NULL)
+        {
+            return -1;
+        }
+        current->chunks = chunks;
+        current->chunk_capacity = capacity;
+    }
+    while (current->num_chunks < needed)
+    {
+        VMO_Chunk *chunk = (VMO_Chunk *)calloc(1, sizeof(VMO_Chunk));
+        if (chunk == NULL)
+        {
+            return -1;
+        }
+        chunk->refs = 1;
+        current->chunks[current->num_chunks++] = chunk;
+    }
+    current->num_vms = num_vms;
+    return 0;
+}
+
+/*
+Brings positions lo to hi of the current version up to date with the vms array, only copying the chunks in
+which a VM actually differs. If an earlier update failed to allocate memory, the whole array is compared.
+The caller must hold the store lock.
+*/
+static int store_sync(VMO_Store *store, int lo, int hi)
+{
+    VMO_System *vmo = store->vmo;
+    int num_vms = vmo->vms != NULL && vmo->num_vms > 0 ? vmo->num_vms : 0;
+    if (store->stale)
+    {
+        lo = 0;
+        hi = num_vms;
+    }
+    hi = hi < num_vms ? hi : num_vms;
+    store->stale = 1;
+
+    if (num_vms != store->current->num_vms)
+    {
+        if (store_own_table(store) != 0 || store_resize(store, num_vms) != 0)
+        {
+            return -1;
+        }
+    }
+    for (int pos = lo > 0 ? lo : 0; pos < hi;)
+    {
+        int c = pos / VMO_SNAPSHOT_CHUNK_SIZE;
+        int end = (c + 1) * VMO_SNAPSHOT_CHUNK_SIZE < hi ? (c + 1) * VMO_SNAPSHOT_CHUNK_SIZE : hi;
+        VMO_Chunk *chunk = store->current->chunks[c];
+        int first = pos;
+        while (first < end && snapshot_vm_equal(&chunk->vms[first % VMO_SNAPSHOT_CHUNK_SIZE], &vmo->vms[first]))
+        {
+            first++;
+        }
+        if (first < end)
+        {
+            if (store_own_table(store) != 0 || (chunk = store_own_chunk(store, c)) == NULL)
+            {
+                return -1;
+            }
+            memcpy(&chunk->vms[first % VMO_SNAPSHOT_CHUNK_SIZE], &vmo->vms[first], (end - first) * sizeof(VM));
+        }
+        pos = end;
+    }
+    store->stale = 0;
+    return 0;
+}
+
+// Takes the store lock; fails without holding it if the store is invalid
+static int store_lock(VMO_Store *store)
+{
+    if (store == NULL)
+    {
+        return -1;
+    }
+    pthread_mutex_lock(&store->lock);
+    if (store->current == NULL)
+    {
+        pthread_mutex_unlock(&store->lock);
+        return -1;
+    }
+    return 0;
+}
+
+static int store_find(VMO_System *vmo, int id)
+{
+    for (int i = 0; vmo->vms != NULL && i < vmo->num_vms; i++)
+    {
+        if (vmo->vms[i].id == id)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+The vmo_store_init function attaches a snapshot store to a VMO system and copies the VMs into its first version.
+The function returns 0 on success, -1 if the input is invalid and -2 if memory allocation fails.
+*/
+int vmo_store_init(VMO_Store *store, VMO_System *vmo)
+{
+    if (store == NULL || vmo == NULL || vmo->num_vms < 0)
+    {
+        return -1;
+    }
+    memset(store, 0, sizeof(VMO_Store));
+    pthread_mutex_init(&store->lock, NULL);
+    store->vmo = vmo;
+    store->current = (VMO_Snapshot *)calloc(1, sizeof(VMO_Snapshot));
+    if (store->current == NULL)
+    {
+        pthread_mutex_destroy(&store->lock);
+        return -2;
+    }
+    store->current->refs = 1;
+    if (store_sync(store, 0, vmo->num_vms) != 0)
+    {
+        vmo_store_free(store);
+        return -2;
+    }
+    return 0;
+}
+
+/*
+The vmo_store_free function drops the reference of the store on its current version.
+Snapshots that readers still hold keep their chunks alive until they are released.
+*/
+void vmo_store_free(VMO_Store *store)
+{
+    if (store == NULL || store->current == NULL)
+    {
+        return;
+    }
+    vmo_snapshot_release(store->current);
+    pthread_mutex_destroy(&store->lock);
+    memset(store, 0, sizeof(VMO_Store));
+}
+
+/*
+Every writer below updates the current version after calling bitmap.h. If that update runs out of memory
+half way, the store is left stale: the next update, vmo_store_refresh or vmo_snapshot_acquire compares every
+VM again, and vmo_snapshot_acquire never hands out the partly updated version.
+
+The vmo_store_add_vm function adds a VM with add_vm and appends it to the current version.
+It returns the result of add_vm, or -1 if the store is invalid.
+*/
+int vmo_store_add_vm(VMO_Store *store, char *name)
+{
+    if (store_lock(store) != 0)
+    {
+        return -1;
+    }
+    int result = add_vm(store->vmo, name);
+    if (result >= 0)
+    {
+        store_sync(store, store->vmo->num_vms - 1, store->vmo->num_vms);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+/*
+The vmo_store_remove_vm function removes a VM with remove_vm. Since remove_vm shifts the VMs after the removed
+one, every chunk from that position on is compared and copied if needed.
+It returns the result of remove_vm, or -1 if the store is invalid.
+*/
+int vmo_store_remove_vm(VMO_Store *store, int id)
+{
+    if (store_lock(store) != 0)
+    {
+        return -1;
+    }
+    int pos = store_find(store->vmo, id);
+    int result = remove_vm(store->vmo, id);
+    if (result == 0)
+    {
+        store_sync(store, pos, store->vmo->num_vms);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+/*
+The vmo_store_start_vm function starts a VM with start_vm. Since start_vm may pause any other VM, the whole
+array is compared, but only the chunks holding a VM whose state changed are copied.
+It returns the result of start_vm, or -1 if the store is invalid.
+*/
+int vmo_store_start_vm(VMO_Store *store, int id)
+{
+    if (store_lock(store) != 0)
+    {
+        return -1;
+    }
+    int result = start_vm(store->vmo, id);
+    if (result == 0)
+    {
+        store_sync(store, 0, store->vmo->num_vms);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+/*
+The vmo_store_stop_vm function stops a VM with stop_vm and copies the one chunk that holds it.
+It returns the result of stop_vm, or -1 if the store is invalid.
+*/
+int vmo_store_stop_vm(VMO_Store *store, int id)
+{
+    if (store_lock(store) != 0)
+    {
+        return -1;
+    }
+    int result = stop_vm(store->vmo, id);
+    if (result == 0)
+    {
+        int pos = store_find(store->vmo, id);
+        store_sync(store, pos, pos + 1);
+    }
+    pthread_mutex_unlock(&store->lock);
+    return result;
+}
+
+/*
+The vmo_store_refresh function compares the whole vms array with the current version, for changes that were
+made directly through bitmap.h. Returns 0 on success, -1 if the store is invalid and -2 if memory allocation fails.
+*/
+int vmo_store_refresh(VMO_Store *store)
+{
+    if (store_lock(store) != 0)
+    {
+        return -1;
+    }
+    int result = store_sync(store, 0, store->vmo->num_vms);
+    pthread_mutex_unlock(&store->lock);
+    return result == 0 ? 0 : -2;
+}
+
+/*
+The vmo_snapshot_acquire function returns the current version of the store with an extra reference.
+It only holds the store lock long enough to take the reference, so readers can then iterate the snapshot
+for as long as they like while the writer keeps changing the VMO system. If an earlier update was left
+unfinished, it is completed first. It returns NULL if the store is invalid or that update runs out of memory.
+*/
+VMO_Snapshot *vmo_snapshot_acquire(VMO_Store *store)
+{
+    if (store_lock(store) != 0)
+    {
+        return NULL;
+    }
+    if (store->stale && store_sync(store, 0, store->vmo->num_vms) != 0)
+    {
+        pthread_mutex_unlock(&store->lock);
+        return NULL;
+    }
+    VMO_Snapshot *snapshot = store->current;
+    __atomic_add_fetch(&snapshot->refs, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&store->lock);
+    return snapshot;
+}
+
+/*
+The vmo_snapshot_release function drops a reference on a snapshot. The last reference frees the chunk table
+and every chunk that no other version shares.
+*/
+void vmo_snapshot_release(VMO_Snapshot *snapshot)
+{
+    if (snapshot == NULL || __atomic_sub_fetch(&snapshot->refs, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+        return;
+    }
+    for (int i = 0; i < snapshot->num_chunks; i++)
+    {
+        snapshot_chunk_release(snapshot->chunks[i]);
+    }
+    free(snapshot->chunks);
+    free(snapshot);
+}
+
+/*
+The vmo_snapshot_get function returns the VM at a position of a snapshot, in the same order as the vms array
+had when the snapshot was taken. It returns NULL if the snapshot is null or the position is out of range.
+*/
+const VM *vmo_snapshot_get(const VMO_Snapshot *snapshot, int position)
+{
+    if (snapshot == NULL || position < 0 || position >= snapshot->num_vms)
+    {
+        return NULL;
+    }
+    return &snapshot->chunks[position / VMO_SNAPSHOT_CHUNK_SIZE]->vms[position % VMO_SNAPSHOT_CHUNK_SIZE];
+}
+
+/*
+The vmo_snapshot_find function searches a snapshot for the first VM with the given ID.
+It returns NULL if the snapshot is null or the VM is not found.
+*/
+const VM *vmo_snapshot_find(const VMO_Snapshot *snapshot, int id)
+{
+    for (int i = 0; snapshot != NULL && i < snapshot->num_vms; i++)
+    {
+        const VM *vm = vmo_snapshot_get(snapshot, i);
+        if (vm->id == id)
+        {
+            return vm;
+        }
+    }
+    return NULL;
+}
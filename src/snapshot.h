@@ -0,0 +1,64 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+
+#include "bitmap.h"
+
+// Number of VMs stored in each chunk of a snapshot
+#define VMO_SNAPSHOT_CHUNK_SIZE 64
+
+// Define a struct for a fixed-size chunk of VMs, shared by every snapshot that has not changed it
+typedef struct
+{
+    int refs;
+    VM vms[VMO_SNAPSHOT_CHUNK_SIZE];
+} VMO_Chunk;
+
+// Define a struct for a point-in-time view of the VMs; a snapshot never changes once acquired
+typedef struct
+{
+    int refs;
+    int num_vms;
+    int num_chunks;
+    int chunk_capacity;
+    VMO_Chunk **chunks;
+} VMO_Snapshot;
+
+// Define a struct for a VMO system whose state can be read through snapshots while it is being changed
+typedef struct
+{
+    VMO_System *vmo;
+    VMO_Snapshot *current;
+    int stale; // Set when an update could not allocate memory, so the next one compares every VM
+    pthread_mutex_t lock;
+} VMO_Store;
+
+// Function to attach a snapshot store to a VMO system
+int vmo_store_init(VMO_Store *store, VMO_System *vmo);
+
+// Function to detach a snapshot store; snapshots that are still acquired stay valid until released
+void vmo_store_free(VMO_Store *store);
+
+// Functions that call the matching bitmap.h function and update the current version of the store
+int vmo_store_add_vm(VMO_Store *store, char *name);
+int vmo_store_remove_vm(VMO_Store *store, int id);
+int vmo_store_start_vm(VMO_Store *store, int id);
+int vmo_store_stop_vm(VMO_Store *store, int id);
+
+// Function to pick up changes made to the VMO system directly through bitmap.h
+int vmo_store_refresh(VMO_Store *store);
+
+// Function to get a consistent view of the current VMs, which must be released with vmo_snapshot_release
+VMO_Snapshot *vmo_snapshot_acquire(VMO_Store *store);
+
+// Function to release a snapshot; this may be called from any thread
+void vmo_snapshot_release(VMO_Snapshot *snapshot);
+
+// Function to get the VM at a position of a snapshot, or NULL if the position is out of range
+const VM *vmo_snapshot_get(const VMO_Snapshot *snapshot, int position);
+
+// Function to find the first VM with the given ID in a snapshot, or NULL if there is none
+const VM *vmo_snapshot_find(const VMO_Snapshot *snapshot, int id);
+
+#endif
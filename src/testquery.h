@@ -0,0 +1,179 @@
+#include <cxxtest/TestSuite.h>
+#include "../src/query.h"
+
+class SampleTestSuite : public CxxTest::TestSuite
+{
+public:
+    void testIndexBuild_NullVMO()
+    {
+        VMO_Index index;
+        TS_ASSERT_EQUALS(vmo_index_build(&index, NULL), -1);
+        TS_ASSERT_EQUALS(vmo_index_build(NULL, NULL), -1);
+    }
+
+    void testQuery_AllSortedById()
+    {
+        VM vms[4] = {{3, "db-3", VM_STATE_STOPPED}, {1, "web-1", VM_STATE_RUNNING}, {4, "db-4", VM_STATE_PAUSED}, {2, "db-2", VM_STATE_PAUSED}};
+        VMO_System vmo = {vms, 4};
+        VMO_Index index;
+        TS_ASSERT_EQUALS(vmo_index_build(&index, &vmo), 0);
+        VMO_Query query;
+        vmo_query_init(&query, 10);
+        VM results[10];
+        VMO_Cursor next;
+        TS_ASSERT_EQUALS(vmo_query(&index, &query, results, &next), 4);
+        for (int i = 0; i < 4; i++)
+        {
+            TS_ASSERT_EQUALS(results[i].id, i + 1);
+        }
+        TS_ASSERT_EQUALS(next.valid, 0);
+        vmo_index_free(&index);
+    }
+
+    void testQuery_StateAndPrefix()
+    {
+        VM vms[5] = {{3, "db-3", VM_STATE_PAUSED}, {1, "web-1", VM_STATE_PAUSED}, {4, "db-4", VM_STATE_PAUSED},
+                     {2, "db-2", VM_STATE_RUNNING}, {5, "db-5", VM_STATE_PAUSED}};
+        VMO_System vmo = {vms, 5};
+        VMO_Index index;
+        vmo_index_build(&index, &vmo);
+        VMO_Query query;
+        vmo_query_init(&query, 10);
+        query.state_mask = VMO_STATE_BIT(VM_STATE_PAUSED);
+        query.name_prefix = "db-";
+        query.descending = 1;
+        VM results[10];
+        VMO_Cursor next;
+        TS_ASSERT_EQUALS(vmo_query(&index, &query, results, &next), 3);
+        TS_ASSERT_EQUALS(results[0].id, 5);
+        TS_ASSERT_EQUALS(results[1].id, 4);
+        TS_ASSERT_EQUALS(results[2].id, 3);
+        vmo_index_free(&index);
+    }
+
+    void testQuery_IdRangeSortedByName()
+    {
+        VM vms[4] = {{1, "d", VM_STATE_STOPPED}, {2, "c", VM_STATE_STOPPED}, {3, "b", VM_STATE_STOPPED}, {4, "a", VM_STATE_STOPPED}};
+        VMO_System vmo = {vms, 4};
+        VMO_Index index;
+        vmo_index_build(&index, &vmo);
+        VMO_Query query;
+        vmo_query_init(&query, 10);
+        query.min_id = 2;
+        query.max_id = 3;
+        query.sort_by = VMO_SORT_BY_NAME;
+        VM results[10];
+        VMO_Cursor next;
+        TS_ASSERT_EQUALS(vmo_query(&index, &query, results, &next), 2);
+        TS_ASSERT_EQUALS(std::string(results[0].name), "b");
+        TS_ASSERT_EQUALS(std::string(results[1].name), "c");
+        vmo_index_free(&index);
+    }
+
+    void testQuery_CursorPagination()
+    {
+        VMO_System vmo = init_vmo_system(10);
+        VMO_Index index;
+        vmo_index_build(&index, &vmo);
+        VMO_Query query;
+        vmo_query_init(&query, 3);
+        VM results[3];
+        VMO_Cursor next;
+        int seen = 0;
+        for (int page = 0; page < 4; page++)
+        {
+            int count = vmo_query(&index, &query, results, &next);
+            TS_ASSERT_EQUALS(count, page < 3 ? 3 : 1);
+            for (int i = 0; i < count; i++)
+            {
+                TS_ASSERT_EQUALS(results[i].id, seen++);
+            }
+            query.after = next;
+        }
+        TS_ASSERT_EQUALS(seen, 10);
+        TS_ASSERT_EQUALS(next.valid, 0);
+        vmo_index_free(&index);
+        free(vmo.vms);
+    }
+
+    void testQuery_FewMatchesUseStateBitmap()
+    {
+        VMO_System vmo = init_vmo_system(1000);
+        vmo.vms[700].state = VM_STATE_PAUSED;
+        vmo.vms[20].state = VM_STATE_PAUSED;
+        vmo.vms[300].state = VM_STATE_PAUSED;
+        VMO_Index index;
+        vmo_index_build(&index, &vmo);
+        VMO_Query query;
+        vmo_query_init(&query, 2);
+        query.state_mask = VMO_STATE_BIT(VM_STATE_PAUSED);
+        VM results[2];
+        VMO_Cursor next;
+        TS_ASSERT_EQUALS(vmo_query(&index, &query, results, &next), 2);
+        TS_ASSERT_EQUALS(results[0].id, 20);
+        TS_ASSERT_EQUALS(results[1].id, 300);
+        TS_ASSERT_EQUALS(next.valid, 1);
+        query.after = next;
+        TS_ASSERT_EQUALS(vmo_query(&index, &query, results, &next), 1);
+        TS_ASSERT_EQUALS(results[0].id, 700);
+        TS_ASSERT_EQUALS(next.valid, 0);
+        vmo_index_free(&index);
+        free(vmo.vms);
+    }
+
+    void testIndex_TracksMutations()
+    {
+        VMO_System vmo = init_vmo_system(3);
+        VMO_Index index;
+        vmo_index_build(&index, &vmo);
+        char name[] = "db-new";
+        int id = vmo_index_add_vm(&index, name);
+        TS_ASSERT_EQUALS(id, 4);
+        TS_ASSERT_EQUALS(vmo_index_start_vm(&index, 1), 0);
+        TS_ASSERT_EQUALS(vmo_index_start_vm(&index, 4), 0);
+        TS_ASSERT_EQUALS(vmo_index_remove_vm(&index, 0), 0);
+        TS_ASSERT_EQUALS(vmo_index_stop_vm(&index, 4), 0);
+
+        VMO_Query query;
+        vmo_query_init(&query, 10);
+        VM results[10];
+        VMO_Cursor next;
+        query.state_mask = VMO_STATE_BIT(VM_STATE_PAUSED);
+        TS_ASSERT_EQUALS(vmo_query(&index, &query, results, &next), 1);
+        TS_ASSERT_EQUALS(results[0].id, 1);
+        query.state_mask = VMO_STATE_BIT(VM_STATE_STOPPED);
+        query.sort_by = VMO_SORT_BY_NAME;
+        TS_ASSERT_EQUALS(vmo_query(&index, &query, results, &next), 2);
+        TS_ASSERT_EQUALS(std::string(results[0].name), "VM2");
+        TS_ASSERT_EQUALS(std::string(results[1].name), "db-new");
+        TS_ASSERT_EQUALS(index.state_count[VM_STATE_STOPPED], 2);
+        TS_ASSERT_EQUALS(index.state_count[VM_STATE_RUNNING], 0);
+        vmo_index_free(&index);
+        free(vmo.vms);
+    }
+
+    void testIndexRefresh_DirectChanges()
+    {
+        VMO_System vmo = init_vmo_system(3);
+        VMO_Index index;
+        vmo_index_build(&index, &vmo);
+        char name[] = "db-new";
+        add_vm(&vmo, name);
+        start_vm(&vmo, 2);
+        remove_vm(&vmo, 0);
+        TS_ASSERT_EQUALS(vmo_index_refresh(&index), 0);
+
+        VMO_Query query;
+        vmo_query_init(&query, 10);
+        VM results[10];
+        VMO_Cursor next;
+        query.sort_by = VMO_SORT_BY_NAME;
+        TS_ASSERT_EQUALS(vmo_query(&index, &query, results, &next), 3);
+        TS_ASSERT_EQUALS(std::string(results[2].name), "db-new");
+        TS_ASSERT_EQUALS(index.state_count[VM_STATE_RUNNING], 1);
+        TS_ASSERT_EQUALS(index.state_count[VM_STATE_STOPPED], 2);
+        TS_ASSERT_EQUALS(vmo_index_refresh(NULL), -1);
+        vmo_index_free(&index);
+        free(vmo.vms);
+    }
+};
@@ -0,0 +1,186 @@
+#include <cxxtest/TestSuite.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "../src/rpc.h"
+
+static const char *rpc_test_path = "/tmp/vmo_testrpc.sock";
+
+static void *rpc_test_serve(void *server)
+{
+    vmo_rpc_server_run((VMO_Rpc_Server *)server);
+    return NULL;
+}
+
+class SampleTestSuite : public CxxTest::TestSuite
+{
+public:
+    VMO_System vmo;
+    VMO_Rpc_Server server;
+    pthread_t thread;
+
+    void startServer(int num_vms, int allow_init = 0)
+    {
+        vmo = init_vmo_system(num_vms);
+        TS_ASSERT_EQUALS(vmo_rpc_server_init(&server, &vmo, rpc_test_path), 0);
+        server.allow_init = allow_init;
+        pthread_create(&thread, NULL, rpc_test_serve, &server);
+    }
+
+    void stopServer()
+    {
+        vmo_rpc_server_stop(&server);
+        pthread_join(thread, NULL);
+        vmo_rpc_server_free(&server);
+        free(vmo.vms);
+    }
+
+    void testRpcServerInit_InvalidPath()
+    {
+        VMO_System system = init_vmo_system(0);
+        VMO_Rpc_Server invalid;
+        TS_ASSERT_EQUALS(vmo_rpc_server_init(&invalid, &system, NULL), -1);
+        TS_ASSERT_EQUALS(vmo_rpc_server_init(NULL, &system, rpc_test_path), -1);
+        free(system.vms);
+    }
+
+    void testRpcConnect_NoServer()
+    {
+        VMO_Rpc_Client client;
+        TS_ASSERT_EQUALS(vmo_rpc_connect(&client, "/tmp/vmo_testrpc_missing.sock"), VMO_RPC_TRANSPORT_ERROR);
+    }
+
+    void testRpc_EveryCall()
+    {
+        startServer(2);
+        VMO_Rpc_Client client;
+        TS_ASSERT_EQUALS(vmo_rpc_connect(&client, rpc_test_path), 0);
+        char name[] = "vm3";
+        TS_ASSERT_EQUALS(vmo_rpc_add_vm(&client, name), 3);
+        TS_ASSERT_EQUALS(vmo_rpc_add_vm(&client, NULL), -1);
+        TS_ASSERT_EQUALS(vmo_rpc_start_vm(&client, 1), 0);
+        TS_ASSERT_EQUALS(vmo_rpc_start_vm(&client, 1), -3);
+        TS_ASSERT_EQUALS(vmo_rpc_get_vm_state(&client, 1), VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(vmo_rpc_stop_vm(&client, 1), 0);
+        TS_ASSERT_EQUALS(vmo_rpc_stop_vm(&client, 9), -4);
+        TS_ASSERT_EQUALS(vmo_rpc_remove_vm(&client, 0), 0);
+        TS_ASSERT_EQUALS(vmo_rpc_remove_vm(&client, 0), -2);
+        // Replacing the system is refused unless the server allows it
+        TS_ASSERT_EQUALS(vmo_rpc_init_vmo_system(&client, 5), -1);
+        TS_ASSERT_EQUALS(vmo_rpc_get_vm_state(&client, 1), VM_STATE_STOPPED);
+        vmo_rpc_close(&client);
+        stopServer();
+        TS_ASSERT_EQUALS(vmo.num_vms, 2);
+    }
+
+    void testRpcInit_OptInAndKeepsVMsOnError()
+    {
+        startServer(3, 1);
+        VMO_Rpc_Client client;
+        TS_ASSERT_EQUALS(vmo_rpc_connect(&client, rpc_test_path), 0);
+        TS_ASSERT_EQUALS(vmo_rpc_start_vm(&client, 2), 0);
+        TS_ASSERT_EQUALS(vmo_rpc_init_vmo_system(&client, -1), -1);
+        TS_ASSERT_EQUALS(vmo_rpc_init_vmo_system(&client, VMO_RPC_MAX_INIT_VMS + 1), -1);
+        TS_ASSERT_EQUALS(vmo_rpc_get_vm_state(&client, 2), VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(vmo_rpc_init_vmo_system(&client, 5), 5);
+        TS_ASSERT_EQUALS(vmo_rpc_get_vm_state(&client, 2), VM_STATE_STOPPED);
+        vmo_rpc_close(&client);
+        stopServer();
+    }
+
+    void testRpc_PipelinedRequests()
+    {
+        startServer(100);
+        VMO_Rpc_Client client;
+        TS_ASSERT_EQUALS(vmo_rpc_connect(&client, rpc_test_path), 0);
+        for (int i = 0; i < VMO_RPC_MAX_PIPELINE; i++)
+        {
+            TS_ASSERT_EQUALS(vmo_rpc_send(&client, i % 2 ? VMO_RPC_GET_VM_STATE : VMO_RPC_START_VM, i % 100, NULL), 0);
+        }
+        TS_ASSERT_EQUALS(vmo_rpc_send(&client, VMO_RPC_GET_VM_STATE, 0, NULL), VMO_RPC_BUSY);
+        TS_ASSERT_EQUALS(vmo_rpc_get_vm_state(&client, 0), VM_STATE_STOPPED);
+        TS_ASSERT_EQUALS(vmo_rpc_start_vm(&client, 0), VMO_RPC_BUSY);
+        int results[VMO_RPC_MAX_PIPELINE];
+        TS_ASSERT_EQUALS(vmo_rpc_receive(&client, results, VMO_RPC_MAX_PIPELINE), 0);
+        for (int i = 0; i < VMO_RPC_MAX_PIPELINE; i++)
+        {
+            // The first 100 requests start the even VMs and read back the odd, still stopped ones
+            if (i < 100)
+            {
+                TS_ASSERT_EQUALS(results[i], i % 2 ? VM_STATE_STOPPED : 0);
+            }
+        }
+        TS_ASSERT_EQUALS(client.pending, 0);
+        vmo_rpc_close(&client);
+        stopServer();
+    }
+
+    void testRpc_ClientClosesWithResultsPending()
+    {
+        startServer(10);
+        for (int round = 0; round < 10; round++)
+        {
+            VMO_Rpc_Client gone;
+            TS_ASSERT_EQUALS(vmo_rpc_connect(&gone, rpc_test_path), 0);
+            for (int i = 0; i < 1000; i++)
+            {
+                vmo_rpc_send(&gone, VMO_RPC_GET_VM_STATE, i % 10, NULL);
+            }
+            TS_ASSERT_EQUALS(vmo_rpc_flush(&gone), 0);
+            shutdown(gone.fd, SHUT_RDWR);
+            vmo_rpc_close(&gone);
+        }
+        // The server must survive writing to the closed connections and keep serving other clients
+        VMO_Rpc_Client client;
+        TS_ASSERT_EQUALS(vmo_rpc_connect(&client, rpc_test_path), 0);
+        TS_ASSERT_EQUALS(vmo_rpc_start_vm(&client, 3), 0);
+        TS_ASSERT_EQUALS(vmo_rpc_get_vm_state(&client, 3), VM_STATE_RUNNING);
+        vmo_rpc_close(&client);
+        stopServer();
+    }
+
+    void testRpc_ManyClients()
+    {
+        startServer(10);
+        VMO_Rpc_Client clients[4];
+        for (int c = 0; c < 4; c++)
+        {
+            TS_ASSERT_EQUALS(vmo_rpc_connect(&clients[c], rpc_test_path), 0);
+            vmo_rpc_send(&clients[c], VMO_RPC_START_VM, c, NULL);
+            vmo_rpc_flush(&clients[c]);
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            int result;
+            TS_ASSERT_EQUALS(vmo_rpc_receive(&clients[c], &result, 1), 0);
+            TS_ASSERT_EQUALS(result, 0);
+            vmo_rpc_close(&clients[c]);
+        }
+        stopServer();
+    }
+
+    void testRpcServerInit_KeepsRunningServer()
+    {
+        startServer(1);
+        VMO_System other = init_vmo_system(0);
+        VMO_Rpc_Server second;
+        TS_ASSERT_EQUALS(vmo_rpc_server_init(&second, &other, rpc_test_path), -2);
+        VMO_Rpc_Client client;
+        TS_ASSERT_EQUALS(vmo_rpc_connect(&client, rpc_test_path), 0);
+        TS_ASSERT_EQUALS(vmo_rpc_get_vm_state(&client, 0), VM_STATE_STOPPED);
+        TS_ASSERT_EQUALS(vmo_rpc_start_vm(&client, 0), 0);
+        vmo_rpc_close(&client);
+        stopServer();
+
+        // The socket of the stopped server is replaced, but a regular file is not
+        TS_ASSERT_EQUALS(vmo_rpc_server_init(&second, &other, rpc_test_path), 0);
+        vmo_rpc_server_free(&second);
+        unlink(rpc_test_path);
+        FILE *file = fopen(rpc_test_path, "w");
+        fclose(file);
+        TS_ASSERT_EQUALS(vmo_rpc_server_init(&second, &other, rpc_test_path), -2);
+        TS_ASSERT_EQUALS(access(rpc_test_path, F_OK), 0);
+        unlink(rpc_test_path);
+        free(other.vms);
+    }
+};
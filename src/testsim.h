@@ -0,0 +1,190 @@
+#include <cxxtest/TestSuite.h>
+#include "../src/sim.h"
+
+static int transition_count;
+
+static void count_transition(void *ctx, int id, VM_State from, VM_State to, VMO_Tick now)
+{
+    transition_count++;
+}
+
+class SampleTestSuite : public CxxTest::TestSuite
+{
+public:
+    void testSimInit_NullVMO()
+    {
+        VMO_Sim sim;
+        TS_ASSERT_EQUALS(vmo_sim_init(&sim, NULL, 10, 10), -1);
+        TS_ASSERT_EQUALS(vmo_sim_init(NULL, NULL, 10, 10), -1);
+    }
+
+    void testSimStart_BootDelay()
+    {
+        VMO_System vmo = init_vmo_system(2);
+        VMO_Sim sim;
+        TS_ASSERT_EQUALS(vmo_sim_init(&sim, &vmo, 100, 50), 0);
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, 1), 0);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 1), VM_STATE_STARTING);
+        TS_ASSERT_EQUALS(vmo_sim_advance(&sim, 99), 0);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 1), VM_STATE_STARTING);
+        TS_ASSERT_EQUALS(vmo_sim_advance(&sim, 1), 1);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 1), VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(sim.now, (VMO_Tick)100);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+
+    void testSimStart_Errors()
+    {
+        VMO_System vmo = init_vmo_system(2);
+        VMO_Sim sim;
+        vmo_sim_init(&sim, &vmo, 10, 10);
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, 7), -2);
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, 0), 0);
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, 0), -3);
+        vmo_sim_run(&sim);
+        TS_ASSERT_EQUALS(vmo_sim_stop_vm(&sim, 0), 0);
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, 0), -4);
+        TS_ASSERT_EQUALS(vmo_sim_stop_vm(&sim, 0), -3);
+        TS_ASSERT_EQUALS(vmo_sim_stop_vm(&sim, 7), -4);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+
+    void testSimStart_PausesOtherVMs()
+    {
+        VMO_System vmo = init_vmo_system(3);
+        VMO_Sim sim;
+        vmo_sim_init(&sim, &vmo, 10, 10);
+        vmo_sim_set_durations(&sim, 2, 30, 10);
+        vmo_sim_start_vm(&sim, 0);
+        vmo_sim_start_vm(&sim, 2);
+        TS_ASSERT_EQUALS(vmo_sim_advance(&sim, 10), 1);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 0), VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 2), VM_STATE_STARTING);
+        TS_ASSERT_EQUALS(vmo_sim_run(&sim), 1);
+        TS_ASSERT_EQUALS(sim.now, (VMO_Tick)30);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 0), VM_STATE_PAUSED);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 2), VM_STATE_RUNNING);
+        // A paused VM resumes without a boot delay
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, 0), 0);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 0), VM_STATE_RUNNING);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+
+    void testSimStop_ShutdownDelay()
+    {
+        VMO_System vmo = init_vmo_system(1);
+        VMO_Sim sim;
+        vmo_sim_init(&sim, &vmo, 0, 1000);
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, 0), 0);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 0), VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(vmo_sim_stop_vm(&sim, 0), 0);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 0), VM_STATE_STOPPING);
+        TS_ASSERT_EQUALS(vmo_sim_advance(&sim, 999), 0);
+        TS_ASSERT_EQUALS(vmo_sim_advance(&sim, 1), 1);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 0), VM_STATE_STOPPED);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+
+    void testSimRemove_CancelsTimer()
+    {
+        VMO_System vmo = init_vmo_system(3);
+        VMO_Sim sim;
+        vmo_sim_init(&sim, &vmo, 10, 10);
+        vmo_sim_set_durations(&sim, 2, 20, 10);
+        vmo_sim_start_vm(&sim, 1);
+        vmo_sim_start_vm(&sim, 2);
+        TS_ASSERT_EQUALS(vmo_sim_remove_vm(&sim, 1), 0);
+        TS_ASSERT_EQUALS(sim.num_pending, 1);
+        TS_ASSERT_EQUALS(vmo_sim_run(&sim), 1);
+        TS_ASSERT_EQUALS(vmo.vms[1].id, 2);
+        TS_ASSERT_EQUALS(vmo.vms[1].state, VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(vmo_sim_remove_vm(&sim, 1), -2);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+
+    void testSimAddVm_DefaultDurations()
+    {
+        VMO_System vmo = init_vmo_system(0);
+        VMO_Sim sim;
+        vmo_sim_init(&sim, &vmo, 5, 5);
+        char name[] = "vm1";
+        int id = vmo_sim_add_vm(&sim, name);
+        TS_ASSERT_EQUALS(id, 1);
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, id), 0);
+        TS_ASSERT_EQUALS(vmo_sim_advance(&sim, 5), 1);
+        TS_ASSERT_EQUALS(vmo.vms[0].state, VM_STATE_RUNNING);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+
+    void testSimWheel_LongAndMixedDurations()
+    {
+        // Durations that land in every level of the wheel and in the overflow bucket
+        VMO_Tick durations[] = {1, 255, 256, 65535, 65536, 70000, 16777216, 4294967295ULL, 4294967296ULL, 10000000000ULL};
+        int n = sizeof(durations) / sizeof(durations[0]);
+        VMO_System vmo = init_vmo_system(n);
+        VMO_Sim sim;
+        vmo_sim_init(&sim, &vmo, 1, 1);
+        transition_count = 0;
+        sim.on_transition = count_transition;
+        for (int i = 0; i < n; i++)
+        {
+            vmo_sim_set_durations(&sim, i, durations[i], 1);
+            vmo_sim_start_vm(&sim, i);
+        }
+        for (int i = 0; i < n; i++)
+        {
+            TS_ASSERT_EQUALS(vmo_sim_advance(&sim, durations[i] - sim.now - 1), 0);
+            TS_ASSERT_EQUALS(get_vm_state(&vmo, i), VM_STATE_STARTING);
+            TS_ASSERT_EQUALS(vmo_sim_advance(&sim, 1), 1);
+            TS_ASSERT_EQUALS(get_vm_state(&vmo, i), VM_STATE_RUNNING);
+        }
+        TS_ASSERT_EQUALS(sim.num_pending, 0);
+        // STOPPED->STARTING, STARTING->RUNNING and RUNNING->PAUSED for all but the last VM
+        TS_ASSERT_EQUALS(transition_count, 3 * n - 1);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+
+    void testSimWheel_DurationSaturates()
+    {
+        VMO_System vmo = init_vmo_system(2);
+        VMO_Sim sim;
+        vmo_sim_init(&sim, &vmo, 1, 1);
+        vmo_sim_advance(&sim, 5);
+        vmo_sim_set_durations(&sim, 0, (VMO_Tick)-3, 1);
+        TS_ASSERT_EQUALS(vmo_sim_start_vm(&sim, 0), 0);
+        TS_ASSERT_EQUALS(sim.timers[sim.vm_data[0].timer].expires, (VMO_Tick)-1);
+        TS_ASSERT_EQUALS(vmo_sim_advance(&sim, 1000), 0);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 0), VM_STATE_STARTING);
+        TS_ASSERT_EQUALS(vmo_sim_run(&sim), 1);
+        TS_ASSERT_EQUALS(get_vm_state(&vmo, 0), VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(sim.now, (VMO_Tick)-1);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+
+    void testSimWheel_ManyPendingTimers()
+    {
+        int n = 200000;
+        VMO_System vmo = init_vmo_system(n);
+        VMO_Sim sim;
+        vmo_sim_init(&sim, &vmo, 1, 1);
+        for (int i = 0; i < n; i++)
+        {
+            vmo_sim_set_durations(&sim, i, 1 + (VMO_Tick)i * 37 % 100000, 1);
+            vmo_sim_start_vm(&sim, i);
+        }
+        TS_ASSERT_EQUALS(sim.num_pending, n);
+        TS_ASSERT_EQUALS(vmo_sim_run(&sim), n);
+        TS_ASSERT_EQUALS(sim.num_pending, 0);
+        TS_ASSERT_EQUALS(sim.num_running, 1);
+        vmo_sim_free(&sim);
+        free(vmo.vms);
+    }
+};
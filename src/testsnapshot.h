@@ -0,0 +1,158 @@
+#include <cxxtest/TestSuite.h>
+#include "../src/snapshot.h"
+
+static int snapshot_test_done;
+static int snapshot_test_torn;
+
+// The writer stops every VM right after starting it, so no snapshot may show more than one running VM
+static void *snapshot_test_read(void *store)
+{
+    while (!__atomic_load_n(&snapshot_test_done, __ATOMIC_ACQUIRE))
+    {
+        VMO_Snapshot *snapshot = vmo_snapshot_acquire((VMO_Store *)store);
+        int running = 0;
+        for (int i = 0; snapshot != NULL && i < snapshot->num_vms; i++)
+        {
+            running += vmo_snapshot_get(snapshot, i)->state == VM_STATE_RUNNING;
+        }
+        if (running > 1)
+        {
+            __atomic_add_fetch(&snapshot_test_torn, 1, __ATOMIC_RELAXED);
+        }
+        vmo_snapshot_release(snapshot);
+    }
+    return NULL;
+}
+
+class SampleTestSuite : public CxxTest::TestSuite
+{
+public:
+    void testStoreInit_NullVMO()
+    {
+        VMO_Store store;
+        TS_ASSERT_EQUALS(vmo_store_init(&store, NULL), -1);
+        TS_ASSERT(vmo_snapshot_acquire(NULL) == NULL);
+    }
+
+    void testSnapshot_MatchesVMs()
+    {
+        VMO_System vmo = init_vmo_system(100);
+        VMO_Store store;
+        TS_ASSERT_EQUALS(vmo_store_init(&store, &vmo), 0);
+        VMO_Snapshot *snapshot = vmo_snapshot_acquire(&store);
+        TS_ASSERT_EQUALS(snapshot->num_vms, 100);
+        for (int i = 0; i < 100; i++)
+        {
+            TS_ASSERT_EQUALS(vmo_snapshot_get(snapshot, i)->id, i);
+        }
+        TS_ASSERT(vmo_snapshot_get(snapshot, 100) == NULL);
+        TS_ASSERT_EQUALS(std::string(vmo_snapshot_find(snapshot, 42)->name), "VM42");
+        vmo_snapshot_release(snapshot);
+        vmo_store_free(&store);
+        free(vmo.vms);
+    }
+
+    void testSnapshot_UnchangedByWriter()
+    {
+        VMO_System vmo = init_vmo_system(3);
+        VMO_Store store;
+        vmo_store_init(&store, &vmo);
+        vmo_store_start_vm(&store, 0);
+        VMO_Snapshot *before = vmo_snapshot_acquire(&store);
+
+        char name[] = "vm4";
+        TS_ASSERT_EQUALS(vmo_store_add_vm(&store, name), 4);
+        TS_ASSERT_EQUALS(vmo_store_start_vm(&store, 1), 0);
+        TS_ASSERT_EQUALS(vmo_store_remove_vm(&store, 2), 0);
+
+        TS_ASSERT_EQUALS(before->num_vms, 3);
+        TS_ASSERT_EQUALS(vmo_snapshot_get(before, 0)->state, VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(vmo_snapshot_get(before, 1)->state, VM_STATE_STOPPED);
+        TS_ASSERT_EQUALS(vmo_snapshot_get(before, 2)->id, 2);
+
+        VMO_Snapshot *after = vmo_snapshot_acquire(&store);
+        TS_ASSERT_EQUALS(after->num_vms, 3);
+        TS_ASSERT_EQUALS(vmo_snapshot_get(after, 0)->state, VM_STATE_PAUSED);
+        TS_ASSERT_EQUALS(vmo_snapshot_get(after, 1)->state, VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(vmo_snapshot_get(after, 2)->id, 4);
+        vmo_snapshot_release(before);
+        vmo_snapshot_release(after);
+        vmo_store_free(&store);
+        free(vmo.vms);
+    }
+
+    void testSnapshot_SharesUnchangedChunks()
+    {
+        VMO_System vmo = init_vmo_system(4 * VMO_SNAPSHOT_CHUNK_SIZE);
+        VMO_Store store;
+        vmo_store_init(&store, &vmo);
+        vmo_store_start_vm(&store, 1);
+        VMO_Snapshot *before = vmo_snapshot_acquire(&store);
+        TS_ASSERT_EQUALS(vmo_store_stop_vm(&store, 1), 0);
+        TS_ASSERT_EQUALS(vmo_store_start_vm(&store, 3 * VMO_SNAPSHOT_CHUNK_SIZE), 0);
+        VMO_Snapshot *after = vmo_snapshot_acquire(&store);
+        TS_ASSERT(before->chunks[0] != after->chunks[0]);
+        TS_ASSERT(before->chunks[1] == after->chunks[1]);
+        TS_ASSERT(before->chunks[2] == after->chunks[2]);
+        TS_ASSERT(before->chunks[3] != after->chunks[3]);
+        TS_ASSERT_EQUALS(after->chunks[1]->refs, 2);
+        vmo_snapshot_release(before);
+        TS_ASSERT_EQUALS(after->chunks[1]->refs, 1);
+        vmo_snapshot_release(after);
+        vmo_store_free(&store);
+        free(vmo.vms);
+    }
+
+    void testStoreRefresh_DirectChanges()
+    {
+        VMO_System vmo = init_vmo_system(2);
+        VMO_Store store;
+        vmo_store_init(&store, &vmo);
+        char name[] = "direct";
+        add_vm(&vmo, name);
+        start_vm(&vmo, 1);
+        TS_ASSERT_EQUALS(vmo_store_refresh(&store), 0);
+        VMO_Snapshot *snapshot = vmo_snapshot_acquire(&store);
+        TS_ASSERT_EQUALS(snapshot->num_vms, 3);
+        TS_ASSERT_EQUALS(vmo_snapshot_get(snapshot, 1)->state, VM_STATE_RUNNING);
+        TS_ASSERT_EQUALS(std::string(vmo_snapshot_get(snapshot, 2)->name), "direct");
+        vmo_store_free(&store);
+        // The snapshot outlives the store
+        TS_ASSERT_EQUALS(vmo_snapshot_get(snapshot, 0)->id, 0);
+        vmo_snapshot_release(snapshot);
+        free(vmo.vms);
+    }
+
+    void testSnapshot_ConcurrentReaders()
+    {
+        VMO_System vmo = init_vmo_system(1000);
+        VMO_Store store;
+        vmo_store_init(&store, &vmo);
+        snapshot_test_done = 0;
+        snapshot_test_torn = 0;
+        pthread_t readers[3];
+        for (int r = 0; r < 3; r++)
+        {
+            pthread_create(&readers[r], NULL, snapshot_test_read, &store);
+        }
+        char name[] = "vm";
+        for (int i = 0; i < 20000; i++)
+        {
+            vmo_store_start_vm(&store, i % 1000);
+            vmo_store_stop_vm(&store, i % 1000);
+            if (i % 100 == 0)
+            {
+                vmo_store_add_vm(&store, name);
+                vmo_store_remove_vm(&store, vmo.vms[vmo.num_vms - 1].id);
+            }
+        }
+        __atomic_store_n(&snapshot_test_done, 1, __ATOMIC_RELEASE);
+        for (int r = 0; r < 3; r++)
+        {
+            pthread_join(readers[r], NULL);
+        }
+        TS_ASSERT_EQUALS(snapshot_test_torn, 0);
+        vmo_store_free(&store);
+        free(vmo.vms);
+    }
+};